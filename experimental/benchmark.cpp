@@ -0,0 +1,370 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "corners.hpp"
+#include "illumination.hpp"
+#include "imageio.hpp"
+#include "quality.hpp"
+#include "shapes.hpp"
+#include "structured_page.hpp"
+#include "training.hpp"
+
+// Runs the sheet line set-up on every image in a directory with each
+// staff line engine, and reports the time taken and how well the staff
+// coordinates of the engines agree, and what the periodicity check
+// saves the Hough engine. Does the same for finding the page
+// corners at full resolution and coarse-to-fine, and for finding the
+// sheet line outlines on the dense and the run-length encoded page,
+// for building pixel and bit samples for the shapes on each line and
+// looking them up in a knn model, and for segmenting the shapes line by
+// line and once for the page. Times the illumination normalization,
+// loading the photos with and without reduced decoding, and the rotation
+// check that photos with an EXIF orientation could skip. Photos the
+// quality gate turns down are only decoded at reduced size, and are
+// skipped.
+
+namespace {
+
+struct EngineResult {
+  double milliseconds = 0.0;
+  size_t lines = 0;
+  size_t realLines = 0;
+  // Top and bottom staff line per sheet line, (-1, -1) if the line was
+  // not recognised as music.
+  std::vector<std::pair<int, int>> coordinates;
+};
+
+EngineResult runEngine(const cv::Mat& page,
+                       musicocr::SheetConfig::GridEngine engine,
+                       bool periodicityCheck = false) {
+  musicocr::SheetConfig config;
+  config.gridEngine = engine;
+  config.periodicityCheck = periodicityCheck;
+  musicocr::Sheet sheet(config);
+  EngineResult result;
+
+  // The sheet code is chatty, keep that out of the timing and output.
+  std::ostringstream sink;
+  std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+  const int64 start = cv::getTickCount();
+  std::vector<cv::Rect> outlines = sheet.find_lines_outlines(page);
+  sheet.createSheetLines(outlines, page);
+  result.milliseconds =
+      (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+  std::cout.rdbuf(out);
+
+  result.lines = sheet.getLineCount();
+  for (size_t i = 0; i < sheet.getLineCount(); i++) {
+    musicocr::SheetLine& sl = sheet.getNthLine(i);
+    if (sl.isRealMusicLine()) {
+      result.realLines++;
+      result.coordinates.push_back(sl.getCoordinates());
+    } else {
+      result.coordinates.emplace_back(-1, -1);
+    }
+  }
+  return result;
+}
+
+double cornerMilliseconds(const musicocr::CornerFinder& finder,
+                          const cv::Mat& gray, bool coarseToFine,
+                          std::vector<cv::Point>& corners) {
+  std::ostringstream sink;
+  std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+  const int64 start = cv::getTickCount();
+  if (coarseToFine) {
+    corners = finder.find_corners_coarse_to_fine(gray);
+  } else {
+    corners = finder.find_corners(finder.find_lines(gray), gray.cols,
+                                  gray.rows);
+  }
+  const double milliseconds =
+      (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+  std::cout.rdbuf(out);
+  return milliseconds;
+}
+
+double outlineMilliseconds(const cv::Mat& page, bool runLength,
+                           size_t& outlines) {
+  musicocr::SheetConfig config;
+  config.runLengthOutlines = runLength;
+  const musicocr::Sheet sheet(config);
+  const int64 start = cv::getTickCount();
+  outlines = sheet.find_lines_outlines(page).size();
+  return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+// Time for a 3-NN model trained on samples to look up each of them
+// once, the way the scanner asks it about one shape at a time.
+double knnMilliseconds(const cv::Mat& samples) {
+  if (samples.rows < 3) return 0.0;
+  cv::Mat labels(samples.rows, 1, CV_32F);
+  for (int i = 0; i < samples.rows; i++) labels.at<float>(i) = i % 10;
+  cv::Ptr<cv::ml::KNearest> knn = cv::ml::KNearest::create();
+  knn->train(samples, cv::ml::ROW_SAMPLE, labels);
+  cv::Mat results;
+  const int64 start = cv::getTickCount();
+  for (int i = 0; i < samples.rows; i++) {
+    knn->findNearest(samples.row(i), 3, results);
+  }
+  return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+// Time to build the samples for all shapes on the music lines of page,
+// with pixel features and with bit features, from each shape's crop as
+// the scanner does, and for a knn model trained on the page's samples
+// to look them up.
+void featureMilliseconds(const cv::Mat& page, double& pixels, double& bits,
+                         double& pixelKnn, double& bitKnn, size_t& shapes) {
+  std::ostringstream sink;
+  std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+  musicocr::Sheet sheet;
+  sheet.createSheetLines(sheet.find_lines_outlines(page), page);
+  musicocr::SampleData pixelData, bitData;
+  bitData.setFeatureType(musicocr::SampleData::BITS);
+  pixels = bits = 0.0;
+  shapes = 0;
+  cv::Mat pixelSamples, bitSamples;
+  for (size_t i = 0; i < sheet.getLineCount(); i++) {
+    const musicocr::SheetLine& sl = sheet.getNthLine(i);
+    if (!sl.isRealMusicLine()) continue;
+    musicocr::ShapeFinder finder{musicocr::ContourConfig()};
+    const std::vector<cv::Rect> boxes = finder.getContourBoxes(sl);
+    const cv::Mat& viewPort = sl.getViewPort();
+    shapes += boxes.size();
+
+    int64 start = cv::getTickCount();
+    for (const auto& r : boxes) {
+      pixelSamples.push_back(pixelData.makeSampleMatrix(viewPort(r), r.x, r.y));
+    }
+    pixels += (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+
+    start = cv::getTickCount();
+    for (const auto& r : boxes) {
+      bitSamples.push_back(bitData.makeSampleMatrix(viewPort(r), r.x, r.y));
+    }
+    bits += (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+  }
+  std::cout.rdbuf(out);
+  pixelKnn = knnMilliseconds(pixelSamples);
+  bitKnn = knnMilliseconds(bitSamples);
+}
+
+// Time to segment the shapes of the music lines of page one line at a
+// time, and once for the whole page (PageShapes). Also counts the boxes
+// the lines get either way; the page hands out each one once, unless it
+// is about as close to two staves.
+void segmentationMilliseconds(const cv::Mat& page, double& perLine,
+                              double& perPage, size_t& lineBoxes,
+                              size_t& pageBoxes, int& shared) {
+  std::ostringstream sink;
+  std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+  musicocr::Sheet sheet;
+  sheet.createSheetLines(sheet.find_lines_outlines(page), page);
+  const musicocr::ContourConfig config;
+  lineBoxes = pageBoxes = 0;
+  int64 start = cv::getTickCount();
+  for (size_t i = 0; i < sheet.getLineCount(); i++) {
+    const musicocr::SheetLine& sl = sheet.getNthLine(i);
+    if (!sl.isRealMusicLine()) continue;
+    musicocr::ShapeFinder finder(config);
+    lineBoxes += finder.getContourBoxes(sl).size();
+  }
+  perLine = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+
+  start = cv::getTickCount();
+  musicocr::PageShapes pageShapes(config);
+  pageShapes.segment(sheet);
+  for (size_t i = 0; i < sheet.getLineCount(); i++) {
+    const musicocr::SheetLine& sl = sheet.getNthLine(i);
+    if (!sl.isRealMusicLine()) continue;
+    musicocr::ShapeFinder finder(config);
+    finder.setPageShapes(&pageShapes, i);
+    pageBoxes += finder.getContourBoxes(sl).size();
+  }
+  perPage = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+  shared = pageShapes.getSharedCount();
+  std::cout.rdbuf(out);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::string directory = argc > 1 ? argv[1] : "test/data";
+  std::vector<cv::String> files;
+  cv::glob(directory + "/*.jpg", files, false);
+  if (files.empty()) {
+    std::cerr << "Benchmark [image directory, default test/data]" << std::endl;
+    return -1;
+  }
+
+  musicocr::CornerFinder cornerFinder;
+  musicocr::CornerConfig pyramidConfig;
+  pyramidConfig.pyramidLevels = 1;
+  const musicocr::CornerFinder pyramidFinder(pyramidConfig);
+  double totalHough = 0.0, totalProjection = 0.0, totalChecked = 0.0;
+  size_t houghReal = 0, checkedReal = 0;
+  double totalCorners = 0.0, totalPyramidCorners = 0.0;
+  double totalOutlines = 0.0, totalRunLengthOutlines = 0.0;
+  double totalPixelFeatures = 0.0, totalBitFeatures = 0.0;
+  double totalPixelKnn = 0.0, totalBitKnn = 0.0;
+  double totalLineSegmentation = 0.0, totalPageSegmentation = 0.0;
+  size_t totalLineBoxes = 0, totalPageBoxes = 0;
+  double totalIllumination = 0.0, totalQuality = 0.0;
+  double totalFullLoad = 0.0, totalReducedLoad = 0.0;
+  double totalRotation = 0.0;
+  int tagged = 0, uprightTagged = 0;
+  int rejected = 0;
+  const musicocr::QualityGate qualityGate;
+  int compared = 0, agreeing = 0;
+  for (const auto& file : files) {
+    // The way the programs load the photos. The quality gate needs no
+    // more than that.
+    const int64 reducedStart = cv::getTickCount();
+    const cv::Mat gray = musicocr::loadGrayscale(file, 0.2);
+    if (gray.empty()) continue;
+    const double reducedLoad = (cv::getTickCount() - reducedStart) * 1000.0
+                               / cv::getTickFrequency();
+    const musicocr::QualityReport quality = qualityGate.check(gray);
+    totalQuality += quality.milliseconds;
+    if (!quality.usable()) {
+      std::cout << file << ": rejected, " << quality.reason() << " (sharpness "
+                << quality.sharpness << ", ruled " << quality.ruledScore
+                << ")" << std::endl;
+      rejected++;
+      continue;
+    }
+    // The way the tests load them, decoded in full and then reduced; for
+    // comparison, on the pages that went through.
+    const int64 fullStart = cv::getTickCount();
+    cv::Mat image = cv::imread(file);
+    cv::resize(image, image, cv::Size(), 0.2, 0.2, cv::INTER_AREA);
+    cv::cvtColor(image, image, cv::COLOR_BGR2GRAY);
+    totalFullLoad +=
+        (cv::getTickCount() - fullStart) * 1000.0 / cv::getTickFrequency();
+    totalReducedLoad += reducedLoad;
+    cv::Mat page;
+    std::vector<cv::Point> corners, pyramidCorners;
+    totalCorners += cornerMilliseconds(cornerFinder, gray, false, corners);
+    totalPyramidCorners +=
+        cornerMilliseconds(pyramidFinder, gray, true, pyramidCorners);
+    // What trusting the EXIF orientation (CornerConfig::detectRotation
+    // off) would save, and whether the photo really was the right way up.
+    if (musicocr::readExifOrientation(file) != 0) {
+      const int64 rotationStart = cv::getTickCount();
+      const bool rotate = cornerFinder.shouldRotate(gray);
+      totalRotation += (cv::getTickCount() - rotationStart) * 1000.0
+                       / cv::getTickFrequency();
+      tagged++;
+      if (!rotate) uprightTagged++;
+    }
+    int cornerDifference = 0;
+    for (size_t i = 0; i < corners.size(); i++) {
+      const cv::Point d = corners[i] - pyramidCorners[i];
+      cornerDifference = std::max(cornerDifference,
+                                  std::max(std::abs(d.x), std::abs(d.y)));
+    }
+    const int64 illuminationStart = cv::getTickCount();
+    const cv::Mat normalized = musicocr::normalizeIllumination(gray);
+    totalIllumination += (cv::getTickCount() - illuminationStart) * 1000.0
+                         / cv::getTickFrequency();
+    {
+      std::ostringstream sink;
+      std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+      cornerFinder.adjust(gray, page);
+      std::cout.rdbuf(out);
+    }
+
+    size_t outlines = 0, runLengthOutlines = 0;
+    totalOutlines += outlineMilliseconds(page, false, outlines);
+    totalRunLengthOutlines +=
+        outlineMilliseconds(page, true, runLengthOutlines);
+
+    double pixelFeatures, bitFeatures, pixelKnn, bitKnn;
+    size_t shapes;
+    featureMilliseconds(page, pixelFeatures, bitFeatures, pixelKnn, bitKnn,
+                        shapes);
+    totalPixelFeatures += pixelFeatures;
+    totalBitFeatures += bitFeatures;
+    totalPixelKnn += pixelKnn;
+    totalBitKnn += bitKnn;
+
+    double lineSegmentation, pageSegmentation;
+    size_t lineBoxes, pageBoxes;
+    int shared;
+    segmentationMilliseconds(page, lineSegmentation, pageSegmentation,
+                             lineBoxes, pageBoxes, shared);
+    totalLineSegmentation += lineSegmentation;
+    totalPageSegmentation += pageSegmentation;
+    totalLineBoxes += lineBoxes;
+    totalPageBoxes += pageBoxes;
+
+    const EngineResult hough =
+        runEngine(page, musicocr::SheetConfig::HOUGH);
+    const EngineResult projection =
+        runEngine(page, musicocr::SheetConfig::PROJECTION);
+    const EngineResult checked =
+        runEngine(page, musicocr::SheetConfig::HOUGH, true);
+    totalHough += hough.milliseconds;
+    totalProjection += projection.milliseconds;
+    totalChecked += checked.milliseconds;
+    houghReal += hough.realLines;
+    checkedReal += checked.realLines;
+
+    // Lines both engines recognised should have the same staff
+    // coordinates, give or take a pixel or two.
+    int maxDifference = 0;
+    for (size_t i = 0; i < hough.coordinates.size(); i++) {
+      const auto& h = hough.coordinates[i];
+      const auto& p = projection.coordinates[i];
+      if (h.first < 0 || p.first < 0) continue;
+      const int difference = std::max(std::abs(h.first - p.first),
+                                      std::abs(h.second - p.second));
+      maxDifference = std::max(maxDifference, difference);
+      compared++;
+      if (difference <= 2) agreeing++;
+    }
+    std::cout << file << ": " << hough.lines << " lines; hough "
+              << hough.realLines << " music lines in "
+              << hough.milliseconds << "ms, projection "
+              << projection.realLines << " music lines in "
+              << projection.milliseconds << "ms, max coordinate difference "
+              << maxDifference << ", max corner difference "
+              << cornerDifference << ", outlines " << outlines
+              << " dense, " << runLengthOutlines << " run-length, "
+              << shapes << " shapes, " << pageBoxes << " from the page ("
+              << shared << " shared)" << std::endl;
+  }
+  std::cout << "loading: full decode " << totalFullLoad << "ms, reduced "
+            << totalReducedLoad << "ms" << std::endl;
+  std::cout << "rotation: " << totalRotation << "ms for " << tagged
+            << " photos with an EXIF orientation, " << uprightTagged
+            << " of them the right way up" << std::endl;
+  std::cout << "total: hough " << totalHough << "ms, projection "
+            << totalProjection << "ms" << std::endl;
+  std::cout << "periodicity check: hough " << totalChecked << "ms, "
+            << checkedReal << " music lines (" << houghReal << " without)"
+            << std::endl;
+  std::cout << "corners: full resolution " << totalCorners
+            << "ms, coarse-to-fine " << totalPyramidCorners << "ms"
+            << std::endl;
+  std::cout << "outlines: dense " << totalOutlines << "ms, run-length "
+            << totalRunLengthOutlines << "ms" << std::endl;
+  std::cout << "shape samples: pixels " << totalPixelFeatures
+            << "ms, bits " << totalBitFeatures << "ms; knn lookups: pixels "
+            << totalPixelKnn << "ms, bits " << totalBitKnn << "ms"
+            << std::endl;
+  std::cout << "segmentation: per line " << totalLineSegmentation << "ms for "
+            << totalLineBoxes << " boxes, per page " << totalPageSegmentation
+            << "ms for " << totalPageBoxes << " boxes" << std::endl;
+  std::cout << "illumination normalization: " << totalIllumination << "ms"
+            << std::endl;
+  std::cout << "quality gate: " << totalQuality << "ms, " << rejected
+            << " of " << files.size() << " photos rejected" << std::endl;
+  std::cout << agreeing << " of " << compared
+            << " lines found by both engines agree within 2px." << std::endl;
+  return 0;
+}
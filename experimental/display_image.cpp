@@ -6,6 +6,7 @@
 #include <opencv2/opencv.hpp>
 
 #include "corners.hpp"
+#include "imageio.hpp"
 #include "structured_page.hpp"
 #include "shapes.hpp"
 #include "training.hpp"
@@ -316,9 +317,9 @@ int main(int argc, char** argv) {
    return -1; 
   }
   string filename = argv[1];
-  Mat image;
-  image = imread(filename, 1);
-  if (!image.data) {
+  // Everything starts with 'gray', the photo reduced to a fifth.
+  gray = musicocr::loadGrayscale(filename, 0.2);
+  if (gray.empty()) {
     cerr << "No image data.";
     return -1;
   }
@@ -335,12 +336,9 @@ int main(int argc, char** argv) {
      knn = cv::ml::StatModel::load<cv::ml::KNearest>(modelfilename);
   }
 
-  resize(image, image, Size(), 0.2, 0.2, INTER_AREA);
   namedWindow("Original Image", WINDOW_AUTOSIZE);
   namedWindow("Warped", WINDOW_AUTOSIZE);
 
-  // everything starts with 'gray'.
-  cvtColor(image, gray, COLOR_BGR2GRAY);
   imshow("Original Image", gray);
 
   namedWindow("Controls", WINDOW_AUTOSIZE);
@@ -0,0 +1,23 @@
+#ifndef binarize_hpp
+#define binarize_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// Sauvola's local threshold: a pixel is ink (255 in the result) if it is
+// at most mean * (1 + k * (stddev / range - 1)), with mean and standard
+// deviation over the window x window square around it (cut off at the
+// image border). Both come from integral images, so the cost per pixel
+// does not depend on the window size. Copes with uneven lighting a lot
+// better than one threshold for the whole image. grey is CV_8UC1.
+cv::Mat sauvolaInk(const cv::Mat& grey, int window, double k,
+                   double range = 128.0);
+
+// The ink that is not part of a horizontal stroke at least width long,
+// i.e. binary ink without the staff lines.
+cv::Mat removeHorizontalInk(const cv::Mat& ink, int width);
+
+}  // namespace musicocr
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef bitimage_hpp
+#define bitimage_hpp
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace musicocr {
+
+// A binary image packed 64 pixels to a word, for counting set pixels
+// in regions with popcount instead of looking at every byte.
+class BitImage {
+ public:
+  BitImage() = default;
+  // Bits are set for the non-zero pixels of binary (CV_8UC1).
+  explicit BitImage(const cv::Mat& binary);
+
+  // Set pixels 255, the others 0.
+  cv::Mat toMat() const;
+
+  int getRows() const { return rows; }
+  int getCols() const { return cols; }
+  bool at(int y, int x) const {
+    return (words[y * wordsPerRow + x / 64] >> (x % 64)) & 1;
+  }
+
+  // Number of set pixels in rect (clipped to the image).
+  int count(const cv::Rect& rect) const;
+
+  // Split rect into grid.width columns and grid.height rows of zones
+  // (as evenly as integer coordinates allow) and count the set pixels
+  // in each, row by row. A grid of Size(1, n) gives a row profile in n
+  // bands, Size(n, 1) a column profile.
+  std::vector<int> zoneCounts(const cv::Rect& rect, cv::Size grid) const;
+
+ private:
+  // Set pixels in columns [from, to) of row y.
+  int countInRow(int y, int from, int to) const;
+
+  int rows = 0, cols = 0;
+  int wordsPerRow = 0;
+  // Row by row, pixel x of a row in bit x % 64 of word x / 64.
+  std::vector<uint64_t> words;
+};
+
+}  // namespace musicocr
+
+#endif
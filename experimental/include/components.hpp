@@ -0,0 +1,45 @@
+#ifndef components_hpp
+#define components_hpp
+
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+#include "runlength.hpp"
+
+namespace musicocr {
+
+// Statistics for one connected component of a binary image, collected
+// while labelling it.
+struct ComponentStats {
+  // For holes, this is the box of the component border around the hole,
+  // which is what findContours reports for the inner contour.
+  cv::Rect box;
+  // Pixel count.
+  int area = 0;
+  cv::Point2d centroid;
+  // Raw moments up to second order, in image coordinates.
+  // m00 is the same as area.
+  double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+  // A hole is a background region enclosed by a component.
+  bool hole = false;
+  // Index of the enclosing hole (for components) or component (for
+  // holes), -1 if there is none. This is the same nesting that
+  // findContours(RETR_TREE) reports. Only known when holes are found.
+  int parent = -1;
+};
+
+// Label the non-zero pixels of binary (8-connected, the same as
+// findContours) in a single sweep over run lengths, and collect
+// per-component statistics on the way. If withHoles is set, the
+// background regions (4-connected) enclosed by components are
+// reported as well, so the boxes are the same as the bounding boxes of
+// findContours(RETR_TREE).
+std::vector<ComponentStats> findComponents(const cv::Mat& binary,
+                                           bool withHoles);
+// The same for an image that is already run-length encoded.
+std::vector<ComponentStats> findComponents(const RunLengthImage& binary,
+                                           bool withHoles);
+
+}  // namespace musicocr
+
+#endif
@@ -22,6 +22,48 @@ using namespace cv;
     int houghThreshold = 50;
     int houghMinLinLength = 32;
     int houghMaxLineGap = 15;
+    // Use houghLinesBanded instead of HoughLinesP, only looking for
+    // lines within houghBandDegrees of horizontal or vertical. Off by
+    // default: the segments found are not exactly the same.
+    bool bandedHough = false;
+    double houghBandDegrees = 15.0;
+    // Coarse-to-fine corner detection: with pyramidLevels > 0, adjust
+    // looks for the outlines on the image reduced that many times with
+    // pyrDown. If that finds candidates for all four sides, it looks for
+    // each side again at full resolution, only in a band reaching
+    // cornerRefineRadius past what the reduced image found, and refines
+    // the corners with cornerSubPix in a window of cornerRefineRadius
+    // around each. Otherwise it falls back to the whole image at full
+    // resolution.
+    int pyramidLevels = 0;
+    int cornerRefineRadius = 24;
+    // For photos taken from a fixed rig: adjust remembers the corners and
+    // rotation of the last page, and reuses them if the image across the
+    // outline of that page still looks the same. The profiles compared
+    // run reuseProfileRadius pixels either side of the outline, every
+    // reuseSampleStep pixels along it; they must not differ by more than
+    // reuseTolerance on average (after taking out the brightness).
+    bool reuseCorners = false;
+    int reuseProfileRadius = 6;
+    int reuseSampleStep = 8;
+    double reuseTolerance = 10.0;
+    // For badly lit photos: adjust divides the image by an estimate of
+    // the paper's brightness (see normalizeIllumination) before warping
+    // it. The corners are still found on the image as it is, since the
+    // normalization also flattens the edge of the page against the
+    // background they go by.
+    bool normalizeIllumination = false;
+    int illuminationScale = 8;
+    int illuminationKernel = 15;
+    // Whether adjust decides with shouldRotate if the page needs to be
+    // turned. Turn off (ocr_shell --upright) when the images already come
+    // the right way up, e.g. from a fixed rig or from a camera whose EXIF
+    // orientation loadGrayscale applied, to save the edge and Hough pass
+    // it takes.
+    // That pass runs on the page warped at a size reduced rotationLevel
+    // times, with the Hough parameters scaled to match; 0 for full size.
+    bool detectRotation = true;
+    int rotationLevel = 1;
   };
 
   class CornerFinder {
@@ -33,16 +75,84 @@ using namespace cv;
                          const std::vector<cv::Point>& corners);
     std::vector<cv::Point> find_corners(const std::vector<cv::Vec4i>& lines,
                                         int width, int height) const;
+    // find_lines and find_corners on a reduced image, with the outlines
+    // and corners refined at full resolution (see
+    // CornerConfig::pyramidLevels).
+    std::vector<cv::Point> find_corners_coarse_to_fine(
+        const cv::Mat& image) const;
     bool shouldRotate(const cv::Mat&) const;
+    // The perspective transform adjustToCorners uses.
+    static cv::Mat getPageTransform(const std::vector<cv::Point>& corners,
+                                    cv::Size size);
     static bool mostLinesAreHorizontal(const std::vector<cv::Vec4i>& lines);
+    // Warps image to target, with the corners found in image at the
+    // corners of target, turned so the lines of music are horizontal.
+    // The turn goes into the same transform, so there is one warp at
+    // full size; deciding on it takes another at reduced size (see
+    // CornerConfig::rotationLevel).
     void adjust(const cv::Mat& image, cv::Mat& target);
+    // The perspective transform (including any rotation) from image to
+    // target of the last call to adjust.
+    const cv::Mat& getTransform() const { return transform; }
+    // The image the last call to adjust warped: its input, or that
+    // normalized for lighting (see CornerConfig::normalizeIllumination).
+    const cv::Mat& getSource() const { return source; }
+    // Whether the last call to adjust reused the corners of the page
+    // before it (see CornerConfig::reuseCorners).
+    bool reusedCorners() const { return reused; }
 
    private:
+    // find_lines for an image that has been reduced level times. The
+    // parameters are scaled to match those at full resolution.
+    std::vector<cv::Vec4i> findLinesAtLevel(const cv::Mat& image,
+                                            int level) const;
+    // shouldRotate for an image that has been reduced level times.
+    bool shouldRotateAtLevel(const cv::Mat& image, int level) const;
+    // image warped by transform into a page reduced level times.
+    cv::Mat warpReduced(const cv::Mat& image, int level) const;
+    // HoughLinesP or houghLinesBanded, depending on the config.
+    void houghLines(const cv::Mat& edges, std::vector<cv::Vec4i>& lines,
+                    int threshold, int minLineLength, int maxLineGap) const;
+    // Sorts the horizontal and vertical lines near the borders into
+    // candidates for each side of the page outline (see find_corners).
+    void sortOutlineCandidates(const std::vector<cv::Vec4i>& lines,
+                               int width, int height,
+                               std::vector<cv::Vec4i>& top,
+                               std::vector<cv::Vec4i>& bottom,
+                               std::vector<cv::Vec4i>& left,
+                               std::vector<cv::Vec4i>& right) const;
+    // Adds the segments find_lines finds in band of image that start in
+    // band and are horizontal (1) or vertical (0), in image coordinates.
+    void findLinesInBand(const cv::Mat& image, const cv::Rect& band,
+                         short horizontal,
+                         std::vector<cv::Vec4i>& lines) const;
+    // Moves corners that are inside the image onto the nearby corner in
+    // image, if there is one within config.cornerRefineRadius.
+    void refineCorners(const cv::Mat& image,
+                       std::vector<cv::Point>& corners) const;
+    // Intensities across the outline through corners, one profile of
+    // 2 * reuseProfileRadius + 1 values after the other, each with its
+    // mean taken out. Parts of the outline too close to the border of
+    // image are left out.
+    std::vector<float> outlineProfiles(
+        const cv::Mat& image, const std::vector<cv::Point>& corners) const;
+    // Whether image shows the same page in the same place as the one
+    // the cached corners are from.
+    bool pageUnchanged(const cv::Mat& image) const;
     cv::Vec4i getOutline(std::vector<cv::Vec4i>& lines,
                          // 0: top, 1: left, 2: bottom, 3: right
                          int orientation,
                          int width, int height) const;
     CornerConfig config;
+    cv::Mat transform;
+    cv::Mat source;
+
+    // The last page, for reuseCorners.
+    std::vector<cv::Point> cachedCorners;
+    std::vector<float> cachedProfiles;
+    cv::Size cachedSize;
+    bool cachedRotate = false;
+    bool reused = false;
   };
 
 }  // namespace musicocr
@@ -0,0 +1,23 @@
+#ifndef hough_hpp
+#define hough_hpp
+
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// Probabilistic Hough transform for near-horizontal and near-vertical
+// lines. Works like cv::HoughLinesP (same parameters, and with a band
+// of 45 degrees or more the same segments out, give or take a pixel),
+// but only votes for angles within bandDegrees of 0 and 90 degrees.
+// With a band of a few degrees that is a small fraction of the 180
+// angles HoughLinesP votes for at 1 degree resolution, and the
+// accumulator is small enough to stay in cache.
+void houghLinesBanded(const cv::Mat& edges, std::vector<cv::Vec4i>& lines,
+                      double rho, double theta, int threshold,
+                      int minLineLength, int maxLineGap,
+                      double bandDegrees);
+
+}  // namespace musicocr
+
+#endif
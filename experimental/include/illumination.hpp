@@ -0,0 +1,25 @@
+#ifndef illumination_hpp
+#define illumination_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// The brightness of the paper without the ink, as an image the size of
+// grey (CV_8UC1): grey reduced by scale, closed with a kernel x kernel
+// square so the dark strokes disappear, median-filtered against what is
+// left of them, and scaled back up. The morphology runs on 1/scale^2 of
+// the pixels, so this is cheap even for full-size photos.
+cv::Mat estimateBackground(const cv::Mat& grey, int scale = 8,
+                           int kernel = 15);
+
+// grey * 255 / background: the paper comes out close to white everywhere
+// and the ink keeps its contrast against it, however unevenly the photo
+// was lit. Where the background is 0, so is the result.
+cv::Mat normalizeIllumination(const cv::Mat& grey, const cv::Mat& background);
+cv::Mat normalizeIllumination(const cv::Mat& grey, int scale = 8,
+                              int kernel = 15);
+
+}  // namespace musicocr
+
+#endif
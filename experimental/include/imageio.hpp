@@ -0,0 +1,32 @@
+#ifndef imageio_hpp
+#define imageio_hpp
+
+#include <string>
+#include <opencv2/imgcodecs.hpp>
+
+namespace musicocr {
+
+// Reads filename as a greyscale image, scaled by scale (0 < scale <= 1).
+// For JPEGs, the decoder does most of the scaling (by 1/2, 1/4 or 1/8,
+// in the DCT domain) and skips the colour conversion, so this is several
+// times faster than reading the whole photo in colour and reducing it.
+// Only the rest of the scale is done with resize (INTER_AREA).
+//
+// The result is close to, but not the same as imread + resize +
+// cvtColor(COLOR_BGR2GRAY): pixels differ by a grey level or two, and
+// the size can be a pixel larger, since the decoder rounds up.
+// Like imread, this turns the image as its EXIF orientation says.
+// Returns an empty Mat if the file can't be read.
+cv::Mat loadGrayscale(const std::string& filename, double scale = 1.0);
+
+// The imread flag loadGrayscale uses for scale, and the reduction (1, 2,
+// 4 or 8) the decoder applies with it.
+int reducedReadFlag(double scale, int* reduction);
+
+// The EXIF orientation (1 to 8) of a JPEG file, 0 if it has none. Only
+// reads the header, not the image data.
+int readExifOrientation(const std::string& filename);
+
+}  // namespace musicocr
+
+#endif
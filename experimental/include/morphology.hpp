@@ -0,0 +1,35 @@
+#ifndef morphology_hpp
+#define morphology_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// Morphology with rectangular kernels, for the long horizontal kernels
+// used to find and remove staff lines. The results are the same as
+// cv::dilate/cv::erode with getStructuringElement(MORPH_RECT, size), the
+// default anchor and the default border, but the cost per pixel does not
+// depend on the kernel size (van Herk/Gil-Werman running min/max, done
+// separately for rows and columns).
+//
+// Only CV_8UC1 gets the fast path; other types go to cv::dilate and
+// cv::erode. Kernel sizes below 1 are treated as 1. src and dst may be
+// the same.
+void dilateRect(const cv::Mat& src, cv::Mat& dst, cv::Size size);
+void erodeRect(const cv::Mat& src, cv::Mat& dst, cv::Size size);
+
+// Dilate, then erode (closing). This fills in dark gaps narrower than
+// the kernel, e.g. removes staff lines from a black-on-white image.
+void closeRect(const cv::Mat& src, cv::Mat& dst, cv::Size size);
+
+// Erode, then dilate (opening).
+void openRect(const cv::Mat& src, cv::Mat& dst, cv::Size size);
+
+// Remove dark horizontal lines from a black-on-white greyscale image:
+// closing with a flat kernel keeps only the lines longer than the
+// kernel, and gray + ~closed turns those white.
+cv::Mat removeHorizontalLines(const cv::Mat& gray, cv::Size size);
+
+}  // namespace musicocr
+
+#endif
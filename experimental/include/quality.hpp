@@ -0,0 +1,71 @@
+#ifndef quality_hpp
+#define quality_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// Limits for QualityGate. The scores are measured on a thumbnail
+// thumbnailWidth pixels wide, and the defaults were chosen on the test
+// photos at that size: they let through everything but the pages the
+// list of test data calls too blurry to use.
+struct QualityConfig {
+  int thumbnailWidth = 320;
+  // Mean grey value.
+  double minBrightness = 50.0;
+  double maxBrightness = 230.0;
+  // Share of pixels that are pure black or pure white.
+  double maxClipped = 0.25;
+  // Difference between the 95th and the 5th percentile of grey values.
+  double minContrast = 20.0;
+  // Standard deviation of the Laplacian over that of the grey values, so
+  // a pale page is not taken for a blurry one.
+  double minSharpness = 0.55;
+  // Share of the thumbnail covered by thin dark lines at least 1/16 of
+  // its width (or height) long: staff lines, horizontal or vertical.
+  // A pixel is on such a line if it is at least rulingInk darker than
+  // what a vertical closing over 5 pixels leaves.
+  int rulingInk = 6;
+  double minRuledScore = 0.02;
+};
+
+struct QualityReport {
+  enum Problem { NONE, UNDEREXPOSED, OVEREXPOSED, LOW_CONTRAST, BLURRY,
+                 NOT_RULED };
+  double brightness = 0.0;
+  double clipped = 0.0;
+  double contrast = 0.0;
+  double sharpness = 0.0;
+  double ruledScore = 0.0;
+  // The first limit the page failed, in the order above.
+  Problem problem = NONE;
+  double milliseconds = 0.0;
+
+  bool usable() const { return problem == NONE; }
+  // Why the page is not usable, "ok" if it is.
+  const char* reason() const;
+};
+
+// A quick look at a photo before it goes through the pipeline, to turn
+// down the ones that have no chance (out of focus, far too dark, not a
+// page of music at all). Takes a few milliseconds whatever the size of
+// the photo.
+class QualityGate {
+ public:
+  QualityGate(const QualityConfig& c) : config(c) {}
+  QualityGate() {}
+  // grey is CV_8UC1, the whole photo.
+  QualityReport check(const cv::Mat& grey) const;
+  // The larger of the two ruled scores for thumbnail, along rows and
+  // along columns.
+  double ruledScore(const cv::Mat& thumbnail) const;
+
+ private:
+  // The ruled score along the rows of thumbnail.
+  double rowRuledScore(const cv::Mat& thumbnail) const;
+  QualityConfig config;
+};
+
+}  // namespace musicocr
+
+#endif
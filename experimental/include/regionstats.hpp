@@ -0,0 +1,40 @@
+#ifndef regionstats_hpp
+#define regionstats_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// Integral images of a greyscale image and of its ink, so that sums,
+// means and variances over any rectangle take four lookups each.
+class RegionStats {
+ public:
+  RegionStats() = default;
+  // grey is CV_8UC1; ink is a binary image of the same size where
+  // non-zero pixels are ink. Without ink, the ink queries return 0.
+  RegionStats(const cv::Mat& grey, const cv::Mat& ink);
+
+  bool empty() const { return sum.empty(); }
+  cv::Size size() const {
+    return empty() ? cv::Size() : cv::Size(sum.cols - 1, sum.rows - 1);
+  }
+
+  // Rectangles are clipped to the image; empty ones give 0.
+  int inkCount(const cv::Rect& rect) const;
+  // Ink pixels / area.
+  double inkDensity(const cv::Rect& rect) const;
+  // Mean and standard deviation of the grey values.
+  double mean(const cv::Rect& rect) const;
+  double stddev(const cv::Rect& rect) const;
+
+ private:
+  cv::Rect clip(const cv::Rect& rect) const;
+
+  // Sum of grey values (CV_32S), of their squares (CV_64F), and of ink
+  // pixels (CV_32S), each one row and column larger than the image.
+  cv::Mat sum, squares, ink;
+};
+
+}  // namespace musicocr
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef runlength_hpp
+#define runlength_hpp
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace musicocr {
+
+// A horizontal run of foreground pixels in one row; end is inclusive.
+struct PixelRun {
+  int start, end;
+};
+
+// A binary image stored as the foreground runs of each row. Thresholded
+// pages are mostly white, so this is a lot smaller than the 8-bit Mat,
+// and the operations below only touch the runs.
+//
+// So far it is used from the threshold on in find_lines_outlines (see
+// SheetConfig::runLengthOutlines), and for the labelling in
+// findComponents (ContourConfig::COMPONENTS). Everything before the
+// threshold, and obtainGridlines' Canny and Hough pass, still work on
+// dense Mats.
+class RunLengthImage {
+ public:
+  RunLengthImage() = default;
+  // An empty (all background) image.
+  RunLengthImage(int rows, int cols);
+  // Non-zero pixels of binary (CV_8UC1) are foreground.
+  explicit RunLengthImage(const cv::Mat& binary);
+
+  // Foreground 255, background 0.
+  cv::Mat toMat() const;
+
+  int getRows() const { return rows; }
+  int getCols() const { return cols; }
+  size_t getRunCount() const { return runs.size(); }
+  // The runs of row y, sorted left to right and not touching each other.
+  const PixelRun* rowBegin(int y) const { return runs.data() + rowStarts[y]; }
+  const PixelRun* rowEnd(int y) const {
+    return runs.data() + rowStarts[y + 1];
+  }
+
+  // Same results as cv::dilate/cv::erode of toMat() with
+  // getStructuringElement(MORPH_RECT, Size(width, 1)), the default
+  // anchor and border.
+  RunLengthImage dilateHorizontal(int width) const;
+  RunLengthImage erodeHorizontal(int width) const;
+  // Dilate, then erode: fills gaps narrower than width.
+  RunLengthImage closeHorizontal(int width) const;
+  // Same as cv::dilate with a MORPH_RECT of Size(1, height).
+  RunLengthImage dilateVertical(int height) const;
+
+  // Foreground pixel counts per row and per column.
+  std::vector<int> rowProjection() const;
+  std::vector<int> columnProjection() const;
+
+ private:
+  // Rows are filled in from top to bottom.
+  void addRun(int start, int end) { runs.push_back({start, end}); }
+  void endRow() { rowStarts.push_back(runs.size()); }
+
+  int rows = 0, cols = 0;
+  std::vector<PixelRun> runs;
+  // Index of the first run of each row in runs, plus the end.
+  std::vector<int> rowStarts = {0};
+};
+
+}  // namespace musicocr
+
+#endif
@@ -6,7 +6,9 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/ml.hpp>
 #include <vector>
+#include "components.hpp"
 #include "recognition.hpp"
+#include "regionstats.hpp"
 #include "structured_page.hpp"
 #include "training_key.hpp"
 
@@ -25,9 +27,93 @@ struct ContourConfig {
   bool l2Gradient = false;
   int horizontalSizeFudge = 30;
   int horizontalHeight = 1;
+
+  // How getContourBoxes segments a line: findContours, or a single
+  // sweep of connected component labelling, which finds the same boxes
+  // and also keeps per-component statistics.
+  enum Segmentation { CONTOURS, COMPONENTS };
+  Segmentation segmentation = CONTOURS;
+
+  // For stat models trained on crops of the staff-free page (TrainKnn
+  // with staff-free): samples are cut from the line's staff-free
+  // viewport, and the fine model's only get thresholded instead of
+  // having the horizontal lines removed crop by crop. Off for models
+  // trained on grey crops, which is what getTrainingDataForLine saves
+  // unless this is on.
+  bool staffFreeSamples = false;
+
+  // The fine stat model only runs when the coarse model's confidence
+  // (0-1) is below this, or when the coarse category needs refining.
+  // Only knn models report a confidence. Others, like the shipped
+  // dtrees models, always report 1, so for them only the category
+  // decides.
+  float fineModelConfidence = 0.8f;
+  // Shapes the coarse model calls 'round' that are no bigger than this
+  // (in pixels) are taken to be specks without asking the fine model.
+  int maxSpeckArea = 9;
+
+  // Geometric pre-classification: shapes that can be decided from
+  // their rectangle alone never reach the stat models. The sizes are
+  // scaled with the line's StaffMetrics; 0 turns a rule off.
+  bool preClassify = true;
+  // Up to this width and height: speck.
+  int maxSpeckSize = 3;
+  // Up to this height and at least this width/height ratio: connector.
+  int maxConnectorHeight = 2;
+  float minConnectorAspect = 8.0f;
+  // Up to this width and at least this height/width ratio: vertical line.
+  int maxVerticalWidth = 4;
+  float minVerticalAspect = 3.5f;
+
+  // Near-identical shapes within a line share one classification.
+  // Shapes join a cluster if their width and height are within
+  // clusterSizeTolerance pixels of the cluster's first shape, their tops
+  // within clusterPositionTolerance pixels (scaled with the line's
+  // StaffMetrics), and their downscaled crops differ by at most
+  // clusterDistance (0-1).
+  // The samples the models see include the shape's position, so the
+  // height on the staff is part of what a shape is. The x position is
+  // left out: along the line it says nothing about the symbol, and
+  // keeping shapes at different x apart would leave nothing to cluster.
+  // The models could still answer differently for a shape further along,
+  // and a cluster then gives it the first shape's answer.
+  bool clusterShapes = true;
+  int clusterSizeTolerance = 1;
+  int clusterPositionTolerance = 4;
+  float clusterDistance = 0.08f;
+
+  // Bar lines are solid strokes: a candidate needs at least this share
+  // of ink in its rectangle. 0 turns the check off, and with it the
+  // integral images it takes (see ShapeFinder::regionStats).
+  float minBarLineInk = 0.0f;
+
+  // With shapes segmented for the whole page (PageShapes), a shape goes
+  // to the sheet line whose staff it is closest to, and also to any
+  // other line whose staff is at most this many pixels (scaled with the
+  // line's StaffMetrics) further away.
+  int shareDistance = 3;
+};
+
+// Per-line counters for the classification stages. Add these up
+// over all lines to get per-page numbers.
+struct ScanStatistics {
+  int shapes = 0;
+  int preClassified = 0;
+  int coarseInferences = 0;
+  int fineInferences = 0;
+  int fineSkipped = 0;
+  // Shapes that went to the stat models, and how many distinct
+  // clusters they formed.
+  int clusteredShapes = 0;
+  int clusters = 0;
+
+  void add(const ScanStatistics& other);
+  void print(std::ostream& out) const;
 };
 
+class SampleData;
 class Shape;
+class PageShapes;
 
 class CompositeShape {
   public:
@@ -69,9 +155,39 @@ class CompositeShape {
     CompositeType type;
 };
 
+// Cheap description of a shape's crop, used to find near-identical
+// shapes so the stat models only need to look at one of them.
+class ShapeDescriptor {
+  public:
+    ShapeDescriptor(const cv::Rect& rect, const cv::Mat& partial);
+
+    // Mean absolute difference of the downscaled crops (0-1), or
+    // a value > 1 if the sizes differ by more than sizeTolerance or the
+    // tops by more than positionTolerance.
+    float distance(const ShapeDescriptor& other, int sizeTolerance,
+                   int positionTolerance) const;
+
+  private:
+    static const int downscaledSize = 8;
+
+    int width, height, top;
+    // downscaledSize x downscaledSize, CV_32F, stretched to 0-1.
+    cv::Mat pixels;
+};
+
+// A group of shapes that share the categories of the first one.
+struct ShapeCluster {
+  ShapeDescriptor representative;
+  TrainingKey::TopLevelCategory topLevelCategory;
+  TrainingKey::Category category;
+};
+
 class ShapeFinder {
  public:
-   ShapeFinder(const ContourConfig& c) : config(c) {}
+   ShapeFinder(const ContourConfig& c)
+     : config(c), maxSpeckSize(c.maxSpeckSize),
+       maxConnectorHeight(c.maxConnectorHeight),
+       maxVerticalWidth(c.maxVerticalWidth) {}
 
    void getTrainingDataForLine(const Mat& focused,
      const string& processedWindowName,
@@ -79,8 +195,47 @@ class ShapeFinder {
      const string& filename,
      ofstream& responsesFile
    );
+   // The same, with the horizontal lines already removed from focused,
+   // e.g. SheetLine::getStaffFreeViewPort. With staffFreeSamples, the
+   // crops saved are cut from staffFree rather than from focused.
+   void getTrainingDataForLine(const Mat& focused, const Mat& staffFree,
+     const string& processedWindowName,
+     const string& questionWindowName,
+     const string& filename,
+     ofstream& responsesFile
+   );
 
+   // Boxes around the shapes in focused, left to right. This removes the
+   // horizontal lines first, with a kernel from the config.
    const std::vector<cv::Rect>& getContourBoxes(const Mat& focused);
+   // The same for a sheet line, using its staff-free viewport, or this
+   // line's shapes of the page shapes (setPageShapes).
+   const std::vector<cv::Rect>& getContourBoxes(const SheetLine& sheetLine);
+   // The same for a whole page, using its staff-free ink with
+   // SheetConfig::SAUVOLA, or else its staff-free page thresholded per
+   // sheet line, each line's band the way its viewport would be.
+   const std::vector<cv::Rect>& getContourBoxes(const Sheet& sheet);
+
+   // For each of the boxes returned by getContourBoxes, the index of the
+   // box enclosing it, or -1.
+   const std::vector<int>& getBoxParents() const { return boxParents; }
+
+   // Statistics for the boxes returned by getContourBoxes, in the same
+   // order. Only filled in with ContourConfig::COMPONENTS segmentation,
+   // and not for shapes that come from the page shapes.
+   const std::vector<ComponentStats>& getComponentStats() const {
+     return componentStats;
+   }
+
+   // Take the shapes of the line with index line from pageShapes instead
+   // of segmenting its viewport. Only the boxes are shared; the shapes
+   // are classified for this line, as their samples hold the position
+   // in its viewport. Lines pageShapes doesn't cover segment themselves.
+   // Does not take ownership; only used by initLineScan.
+   void setPageShapes(PageShapes* shapes, size_t line) {
+     pageShapes = shapes;
+     pageLine = line;
+   }
 
    void initLineScan(const musicocr::SheetLine& sheetLine,
                      const cv::Ptr<cv::ml::StatModel>& statModel,
@@ -109,10 +264,51 @@ class ShapeFinder {
      return compositeShapes;
    }
 
+   const ScanStatistics& getStatistics() const { return statistics; }
+
+   // Assign categories to shapes that are obvious from their rectangle
+   // (specks, thin connectors, thin vertical strokes). Returns false if
+   // the shape needs to go to the stat models.
+   bool preClassify(Shape* shape) const;
+
+   // Predict with statModel and estimate how sure the model is (0-1).
+   // Only knn models can tell us this, other models always get 1.
+   static float predictWithConfidence(
+       const cv::Ptr<cv::ml::StatModel>& statModel,
+       const cv::Mat& sample, float* confidence);
+
+   // Decide if the fine model has to look at a shape the coarse model
+   // put into cat. If not, category is set to what the fine model
+   // would most likely have said.
+   bool needsFineModel(TrainingKey::TopLevelCategory cat, float confidence,
+                       const cv::Rect& rect,
+                       TrainingKey::Category* category) const;
+
  private:
    ContourConfig config;
+   ScanStatistics statistics;
 
    std::vector<cv::Rect> contourBoxes;
+   // For each of contourBoxes, the index of the enclosing box, or -1.
+   std::vector<int> boxParents;
+   std::vector<ComponentStats> componentStats;
+
+   PageShapes* pageShapes = nullptr;
+   size_t pageLine = 0;
+
+   // Ink and grey statistics of the line's viewport, set up by
+   // initLineScan when minBarLineInk needs them. The ink is the page's
+   // if the sheet line has it, and what is darker than the viewport's
+   // Otsu threshold otherwise.
+   RegionStats regionStats;
+   // The sheet line's (set by initLineScan), for scaling the pixel
+   // distances of the bar line scan and the shape neighbourhoods.
+   StaffMetrics staffMetrics;
+   // The pre-classification sizes of config, scaled to the line by
+   // initLineScan.
+   int maxSpeckSize;
+   int maxConnectorHeight;
+   int maxVerticalWidth;
 
    // This maps horizontal positions to vectors of shapes who have
    // this horizontal value as their tl().x.
@@ -121,7 +317,13 @@ class ShapeFinder {
    // All composite shapes (including bar lines)
    std::vector<std::unique_ptr<CompositeShape>> compositeShapes;
 
-   cv::Mat preprocess(const Mat& img);
+   // Segment an image that already had the horizontal lines removed.
+   const std::vector<cv::Rect>& findContourBoxes(const Mat& staffFree);
+   // The same, for its ink (non-zero), already thresholded.
+   const std::vector<cv::Rect>& segmentInk(const Mat& ink);
+
+   // Threshold and invert a staff-free crop for display.
+   cv::Mat preprocess(const Mat& staffFree);
 
    int voicePosition = -1;
 
@@ -131,16 +333,38 @@ class ShapeFinder {
    // Initialise shapes based on rectangles:
    // create shapes with top-level categories and discover
    // neighbourhood relations.
+   // The samples are cut from samplePort: viewPort, or with
+   // staffFreeSamples, the line's staff-free viewport.
    void firstPass(const std::vector<cv::Rect>& rectangles,
-                  const cv::Mat& viewPort,
+                  const cv::Mat& viewPort, const cv::Mat& samplePort,
                   const cv::Ptr<cv::ml::StatModel>& statModel,
                   const cv::Ptr<cv::ml::StatModel>& fineStatModel);
 
+   // Run the stat models on partial (the sample crop of shape's
+   // rectangle), with the samples sd and fineSd make from it. fineSd
+   // preprocesses, as the fine model was trained on preprocessed samples.
+   void classify(Shape* shape, const cv::Mat& partial,
+                 const SampleData& sd, const SampleData& fineSd,
+                 const cv::Ptr<cv::ml::StatModel>& statModel,
+                 const cv::Ptr<cv::ml::StatModel>& fineStatModel);
+
+   // Copy categories from the closest matching cluster, or classify
+   // the shape and start a new cluster with it. partial is the viewport
+   // inside shape's rectangle, sampleCrop what classify gets.
+   void classifyByCluster(Shape* shape, const cv::Mat& partial,
+                          const cv::Mat& sampleCrop,
+                          const SampleData& sd, const SampleData& fineSd,
+                          const cv::Ptr<cv::ml::StatModel>& statModel,
+                          const cv::Ptr<cv::ml::StatModel>& fineStatModel,
+                          std::vector<ShapeCluster>& clusters);
+
    bool isPotentialBarLine(const Shape& s) const;
 
+   // Staff coordinates come from sheetLine, at the position of each
+   // candidate (so they follow the staff if it has a shear fit).
    void scanForBarLines(const cv::Mat& viewPort,
                         const cv::Rect& relativeInnerBox,
-                        const std::pair<int, int>& slCoords); 
+                        const SheetLine& sheetLine);
 
    // look for items that are probably writing between lines or that belong
    // to another sheetline.
@@ -151,7 +375,8 @@ class ShapeFinder {
 
 class Shape {
  public:
-   Shape(const cv::Rect& rect);
+   // Shapes up to smallDistance pixels apart are adjacent.
+   Shape(const cv::Rect& rect, int smallDistance = 2);
 
    void print() const;
 
@@ -204,8 +429,14 @@ class Shape {
      }
    }
 
-   // Decide if shape is adjacent to this and add it if so.
-   void maybeAddNeighbour(Shape* shape);
+   // Decide if shape is adjacent to this and add it if so. Without
+   // checkContainment, containment comes only from the contour hierarchy
+   // (the caller adds it), and a rectangle that merely encloses shape's
+   // is treated like any other overlap.
+   void maybeAddNeighbour(Shape* shape, bool checkContainment = true);
+
+   // shape is inside this.
+   void addContainedShape(Shape* shape);
 
    size_t getNumberOfNeighbours() const;
 
@@ -215,7 +446,7 @@ class Shape {
 
  private:
    // Distances (in pixels) up to this are considered 'adjacent'.
-   static const int smallDistance = 2;
+   int smallDistance;
 
    // Location of this shape relative to the sheet line.
    // Also, size.
@@ -225,9 +456,10 @@ class Shape {
    std::map<TrainingKey::Category, int> beliefs;
 
    // This is the category returned by the stat model.
-   TrainingKey::TopLevelCategory topLevelCategory;
+   TrainingKey::TopLevelCategory topLevelCategory =
+       TrainingKey::TopLevelCategory::unknown;
    // This is the category returned by the fine stat model.
-   TrainingKey::Category category;
+   TrainingKey::Category category = TrainingKey::Category::undefined;
 
    // Does not take ownership of shapes.
    std::map<Neighbourhood, std::vector<Shape*>> neighboursByDirection;
@@ -235,6 +467,49 @@ class Shape {
    void addNeighbour(Neighbourhood where, Shape *shape);
 };
 
+// The shapes of a whole page, segmented once and handed out to the
+// sheet lines by how far they are from each line's staff. Neighbouring
+// viewports overlap by their paddings; this way the shared strip is
+// segmented once, and a line doesn't get the shapes that belong to the
+// staff above or below it. Shapes about as close to two staves go to
+// both lines, and each line classifies them on its own.
+class PageShapes {
+ public:
+   PageShapes(const ContourConfig& c) : config(c) {}
+
+   // Segment the staff-free page of sheet and assign the shapes to its
+   // music lines. Call after Sheet::createSheetLines. Lines whose
+   // viewport was rotated no longer line up with the page; they get no
+   // shapes and are left to segment themselves.
+   void segment(const Sheet& sheet);
+
+   size_t size() const { return boxes.size(); }
+   // In page coordinates. Shapes are sorted left to right.
+   const cv::Rect& getBox(int shape) const { return boxes[shape]; }
+   // The shape enclosing this one, or -1.
+   int getParent(int shape) const { return parents[shape]; }
+
+   // Whether the line with this index in the sheet takes its shapes
+   // from here, and which ones they are, left to right.
+   bool covers(size_t line) const {
+     return line < covered.size() && covered[line];
+   }
+   const std::vector<int>& getLineShapes(size_t line) const {
+     return lineShapes[line];
+   }
+   // Shapes that went to more than one line.
+   int getSharedCount() const;
+
+ private:
+   ContourConfig config;
+   std::vector<cv::Rect> boxes;
+   std::vector<int> parents;
+   std::vector<bool> covered;
+   std::vector<std::vector<int>> lineShapes;
+   // How many lines each shape went to.
+   std::vector<int> lineCounts;
+};
+
 }  // namespace musicocr
 
 #endif
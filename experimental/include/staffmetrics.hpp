@@ -0,0 +1,45 @@
+#ifndef staffmetrics_hpp
+#define staffmetrics_hpp
+
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+// How thick the staff lines on a page are and how far apart, in pixels.
+// The pixel sizes throughout the code were tuned on photos of A4 pages
+// reduced to 0.2, where staff lines are about 6 pixels apart; scaled()
+// converts such a size for a page with different staves.
+struct StaffMetrics {
+  // Width of the pages on those photos after corner adjustment, for
+  // sizes that were tuned as a fraction of the page width.
+  static const int referencePageWidth = 693;
+
+  // The most common vertical run of ink and of paper between two runs
+  // of ink, to a fraction of a pixel. 0 if not known.
+  double lineThickness = 0.0;
+  double staffSpace = 0.0;
+
+  bool empty() const { return staffSpace <= 0.0; }
+  // From one staff line to the next.
+  double lineDistance() const { return lineThickness + staffSpace; }
+  // lineDistance relative to the photos the sizes were tuned on, 1 if
+  // not known.
+  double scale() const;
+  // A length tuned on those photos, for this page. At least 1.
+  int scaled(int pixels) const;
+  // The same for an area.
+  int scaledArea(int pixels) const;
+};
+
+// Estimate from the vertical runs of a binary image (non-zero is ink)
+// with the staff lines horizontal: staff lines make up the bulk of both
+// the short ink and the short paper runs. Comes back empty if the paper
+// runs have no clear peak (no staves, or too pale to binarize).
+StaffMetrics staffMetricsFromInk(const cv::Mat& ink);
+
+// The same for a greyscale page, binarized with a local mean threshold.
+StaffMetrics estimateStaffMetrics(const cv::Mat& grey);
+
+}  // namespace musicocr
+
+#endif
@@ -5,6 +5,8 @@
 #include <opencv2/imgproc.hpp>
 #include <vector>
 
+#include "staffmetrics.hpp"
+
 namespace musicocr {
 
 class SheetLine;
@@ -23,6 +25,79 @@ struct SheetConfig {
   int houghThreshold = 100;
   int houghMinLineLength = 50;
   int houghMaxLineGap = 15;
+  // The staff-free page removes horizontal lines at least
+  // page width / horizontalSizeFudge long.
+  int horizontalSizeFudge = 30;
+  // Find the sheet line outlines on a run-length encoding of the
+  // thresholded page, with a 7x7 dilation in place of the blur. Outlines
+  // can be a few pixels larger or smaller than from the blurred image.
+  // Only the part after the threshold is run-length encoded: the
+  // closing and adaptiveThreshold work on the grey page, and so still
+  // read and write the dense Mat.
+  bool runLengthOutlines = false;
+
+  // How sheet lines find their staff lines. HOUGH is Canny and
+  // HoughLinesP on the viewport, PROJECTION uses row projections of
+  // the removed lines in a few vertical strips.
+  enum GridEngine { HOUGH, PROJECTION };
+  GridEngine gridEngine = HOUGH;
+  // PROJECTION: number of strips, and the fraction of a strip's width
+  // a row needs to be covered by line pixels to be a staff line.
+  int projectionStrips = 4;
+  float projectionCoverage = 0.5f;
+  // Line pixels are at least projectionContrast darker than the
+  // brightest pixel within projectionKernel rows around them.
+  int projectionContrast = 20;
+  int projectionKernel = 7;
+
+  // What to do about sheet lines whose staff isn't level. ROTATE
+  // (for slopes of at least 0.025) resamples the viewport level and
+  // looks for the staff lines again. SHEAR leaves the pixels alone and
+  // fits the vertical offset of the staff along the line, a polynomial
+  // of shearDegree in x measured in shearStrips strips. Ask the sheet
+  // line where its staff is at a given x (SheetLine::getCoordinatesAt).
+  enum Deskew { ROTATE, SHEAR };
+  Deskew deskew = ROTATE;
+  int shearDegree = 2;
+  int shearStrips = 8;
+
+  // How ink is told from paper after the outlines are found. PER_STAGE
+  // thresholds each image where it is needed, with that stage's own
+  // settings. SAUVOLA binarizes the page once in createSheetLines
+  // (sauvolaInk, with sauvolaWindow and sauvolaK), and sheet lines take
+  // regions of that for finding their shapes (ShapeFinder::
+  // getContourBoxes) and for the shapes' ink statistics (RegionStats).
+  // Nothing else uses it: the staff line search (obtainGridlines), the
+  // stat model samples, which have to match the training crops, and the
+  // display crops threshold for themselves, as do rotated sheet lines.
+  enum Binarization { PER_STAGE, SAUVOLA };
+  Binarization binarization = PER_STAGE;
+  int sauvolaWindow = 31;
+  double sauvolaK = 0.2;
+
+  // Measure the staves in createSheetLines (estimateStaffMetrics) and
+  // scale the pixel sizes tuned on 0.2-scaled photos by them: the limits
+  // on sheet line outlines, the sheet line paddings, the staff removal
+  // kernel (the width of those pages / horizontalSizeFudge, scaled,
+  // instead of this page's width / horizontalSizeFudge) and the
+  // distances shapes and bar lines are judged by. Pages without a clear
+  // staff space keep the sizes as they are.
+  bool scaleToStaff = false;
+
+  // Before looking for the staff lines of a sheet line, check that the
+  // rows of its inner box repeat the way a staff's do
+  // (SheetLine::hasPeriodicRows), and give up on it if they don't. This
+  // is cheap next to the grid engines, and drops text and empty areas
+  // that made it through the outline filter. The row profile of the long
+  // horizontal lines, in any of periodicityStrips strips, needs an
+  // autocorrelation of at least minPeriodicity at some shift between 3
+  // rows and a quarter of the height, and a contrast (root mean square,
+  // in grey levels) of at least minPeriodicContrast. Rejected lines are
+  // still counted by getLineCount, but aren't music lines.
+  bool periodicityCheck = false;
+  int periodicityStrips = 4;
+  float minPeriodicity = 0.35f;
+  float minPeriodicContrast = 0.5f;
 };
 
 class Sheet {
@@ -37,8 +112,32 @@ class Sheet {
    // and create sheet lines for them.
    // Also performs corrective local rotations and initialised
    // per-sheetline horizontal lines (for coordinate finding).
+   // Copies the page and computes the staff-free page first, so the
+   // sheet lines can share them.
    void createSheetLines(const std::vector<cv::Rect>&, const cv::Mat&);
 
+   // The corner-adjusted page with the staff lines (and any other long
+   // horizontal lines) removed, for segmenting shapes. The staff-free
+   // viewports of the sheet lines are regions of this.
+   const cv::Mat& getStaffFreePage() const { return staffFreePage; }
+
+   // The ink of the page (255) and the same without the staff lines,
+   // with SheetConfig::SAUVOLA. Empty otherwise.
+   const cv::Mat& getInkPage() const { return inkPage; }
+   const cv::Mat& getStaffFreeInkPage() const { return staffFreeInkPage; }
+
+   // The staves measured with SheetConfig::scaleToStaff, empty otherwise.
+   const StaffMetrics& getStaffMetrics() const { return staffMetrics; }
+
+   // The image the page was warped from, and the transform from it to
+   // the page (CornerFinder::getTransform). If this is set before
+   // createSheetLines, sheet lines that need rotating resample this
+   // image instead of their already resampled viewport.
+   void setSource(const cv::Mat& image, const cv::Mat& transform) {
+     source = image;
+     sourceTransform = transform;
+   }
+
    size_t size() const { return lineGroups.size(); }
    size_t getLineCount() const { return sheetLines.size(); }
 
@@ -46,6 +145,7 @@ class Sheet {
      return *lineGroups[i];
    }
    SheetLine& getNthLine(size_t i) { return sheetLines[i]; }
+   const SheetLine& getNthLine(size_t i) const { return sheetLines[i]; }
 
    void printSheetInfo() const; 
    std::vector<std::vector<int>> getSheetInfo() const;
@@ -61,6 +161,10 @@ class Sheet {
    std::vector<std::unique_ptr<LineGroup>> lineGroups;
    std::vector<SheetLine> sheetLines;
    SheetConfig config;
+   cv::Mat page, staffFreePage;
+   cv::Mat inkPage, staffFreeInkPage;
+   cv::Mat source, sourceTransform;
+   StaffMetrics staffMetrics;
 };
 
 class LineGroup {
@@ -81,19 +185,38 @@ class SheetLine {
    // bounding box, coordinates relative to Mat.
    // Mat is a greyscale, corner-adjusted page.
    // SheetLine will initialize its local viewport
-   // to Rect(Mat).
-   SheetLine(const cv::Rect&, const cv::Mat&);
+   // to Rect(Mat), a region of it until the viewport is rotated.
+   // staffFreePage is the same page with the horizontal lines removed
+   // (Sheet::getStaffFreePage), of which the staff-free viewport is a
+   // region. Lines that need rotating recompute it from their rotated
+   // viewport, with a kernel of staffKernel. The paddings around the
+   // inner box are scaled with staffMetrics (Sheet::getStaffMetrics).
+   SheetLine(const cv::Rect&, const cv::Mat&, const cv::Mat& staffFreePage,
+             const cv::Size& staffKernel,
+             const StaffMetrics& staffMetrics = StaffMetrics());
 
    int getLeftEdge() const { return boundingBox.tl().x; }
    int getRightEdge() const { return boundingBox.br().x; }
 
    const cv::Rect& getBoundingBox() const { return boundingBox; }
    const cv::Rect& getInnerBox() const { return innerBox; }
+   // Those of the page, for scaling pixel sizes; may be empty.
+   const StaffMetrics& getStaffMetrics() const { return staffMetrics; }
 
    bool hasShapeFinder() const { return (shapeFinder.get() != NULL); }
    ShapeFinder& getShapeFinder() { return *(shapeFinder.get()); }
    void setShapeFinder(ShapeFinder* sf);
 
+   // Find the staff lines with the engine selected in config.
+   void findHorizontalLines(const SheetConfig& config);
+
+   // Whether the rows of the inner box repeat like a staff's, as set up
+   // by SheetConfig::periodicityCheck. Sets realMusicLine to false if
+   // they don't.
+   bool hasPeriodicRows(const SheetConfig& config);
+   // False if hasPeriodicRows turned the line down.
+   bool hasRepeatingRows() const { return periodicRows; }
+
    // Transform a clone of viewport and obtain horizontal lines.
    std::vector<cv::Vec4i> obtainGridlines() const;
 
@@ -103,12 +226,23 @@ class SheetLine {
    // horizontal lines are found.
    void accumulateHorizontalLines(const std::vector<cv::Vec4i>& lines);
 
+   // Find the staff lines from row projections of the long horizontal
+   // lines in the viewport (the ones the staff-free viewport is
+   // without). Produces the same kind of horizontal lines as
+   // accumulateHorizontalLines, one per staff line across the inner box.
+   void projectHorizontalLines(const SheetConfig& config);
+
    float getSlope() const;
 
    bool isRealMusicLine() const { return realMusicLine; }
 
    // How much has this been rotated relative to the whole page.
    float getRotationSlope() const { return rotationSlope; }
+   // See Sheet::setSource.
+   void setSource(const cv::Mat& image, const cv::Mat& transform) {
+     source = image;
+     sourceTransform = transform;
+   }
    void rotateViewPort(float angle);
 
    // Try to improve coordinate finding done in accumulateHorizontalLines.
@@ -116,7 +250,28 @@ class SheetLine {
 
    // Return previously found coordinates (top, bottom line).
    std::pair<int, int> getCoordinates() const;
+
+   // Fit the offset of the staff along the line (SheetConfig::SHEAR).
+   // Leaves the line without one if the staff lines can't be followed.
+   void fitShear(const SheetConfig& config);
+   bool hasShear() const { return !shear.empty(); }
+   // How far the staff is below its position at the left edge of the
+   // inner box, at column x of the viewport. 0 without a shear fit.
+   double getShearOffset(int x) const;
+   // The top and bottom staff line at column x of the viewport. Without
+   // a shear fit, the same as getCoordinates.
+   std::pair<int, int> getCoordinatesAt(int x) const;
    const cv::Mat& getViewPort() const { return viewPort; }
+   // The viewport with the staff lines removed.
+   const cv::Mat& getStaffFreeViewPort() const { return staffFreeViewPort; }
+
+   // Take the ink of the viewport, with and without staff lines, from
+   // page-wide binary images (Sheet::getInkPage). Rotating the viewport
+   // drops them again, as they no longer line up with it.
+   void setInk(const cv::Mat& inkPage, const cv::Mat& staffFreeInkPage);
+   // Empty if there is no page-wide ink.
+   const cv::Mat& getInk() const { return ink; }
+   const cv::Mat& getStaffFreeInk() const { return staffFreeInk; }
 
    void printInfo(cv::Mat& draw) const;
 
@@ -125,19 +280,40 @@ class SheetLine {
    static const int horizontalPaddingPx = 10;
    static const int minHorizontalLines = 4;
 
-   static cv::Rect BoundingBox(const cv::Rect&, int rows, int cols);
+   static cv::Rect BoundingBox(const cv::Rect&, int rows, int cols,
+                               const StaffMetrics& staffMetrics);
+
+   // Pick the staff lines out of horizontals (sorted top to bottom, one
+   // per line) and store them, or set realMusicLine to false.
+   void selectHorizontalLines(const std::vector<cv::Vec4i>& horizontals);
+
+   // The pixels of the long horizontal lines that are clearly darker
+   // than their surroundings above and below.
+   cv::Mat findLineMask(const SheetConfig& config) const;
 
    std::unique_ptr<ShapeFinder> shapeFinder;
 
-   cv::Mat viewPort;
+   cv::Mat viewPort, staffFreeViewPort;
+   cv::Mat ink, staffFreeInk;
+   cv::Mat source, sourceTransform;
+   cv::Size staffKernel;
+   StaffMetrics staffMetrics;
    cv::Rect boundingBox, innerBox;
    std::vector<cv::Vec4i> horizontalLines;
 
    float rotationSlope = 0.0;
 
+   // Polynomial coefficients of the staff offset, for powers 1 .. n of
+   // the position across the inner box (0 at its left, 1 at its right),
+   // and where the top and bottom staff line are at its left edge.
+   std::vector<double> shear;
+   double shearTop = 0.0, shearBottom = 0.0;
+
    // flip this to false when it turns out this line doesn't contain
    // music notes.
    bool realMusicLine = true;
+   // Set to false by hasPeriodicRows, for printSheetInfo.
+   bool periodicRows = true;
 };
 
 }  // namespace musicocr
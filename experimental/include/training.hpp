@@ -16,6 +16,19 @@ namespace musicocr {
 // and response matrices out of this.
 class SampleData {
   public:
+    // What goes into a sample. PIXELS is the crop resized to
+    // imageSize x imageSize. BITS is computed on the binarized crop with
+    // popcount: the ink density, the ink in a 5x5 grid of zones, and row
+    // and column profiles in 10 bands each. Either way, the crop's size
+    // and position come last. Models only work with the features they
+    // were trained on; the two have different lengths (featureCount).
+    enum FeatureType { PIXELS, BITS };
+    void setFeatureType(FeatureType type) { featureType = type; }
+    FeatureType getFeatureType() const { return featureType; }
+    static int featureCount(FeatureType type);
+    // The features a trained model expects, by its feature count.
+    static FeatureType featureTypeOf(const cv::ml::StatModel& model);
+
     cv::Mat makeSampleMatrix(const cv::Mat&, int xcoord, int ycoord) const;
 
     // Add one image and corresponding label.
@@ -23,6 +36,10 @@ class SampleData {
     void addTrainingData(const cv::Mat&, int label, int xcoord, int ycoord, const std::string& basename);
 
     void setPreprocessing(bool prep) { preprocess = prep; }
+    // The crops already had the horizontal lines removed, being regions
+    // of Sheet::getStaffFreePage() or saved from there; preprocessing
+    // then only thresholds them.
+    void setStaffFree(bool free) { staffFree = free; }
 
     bool isReadyToTrain() const;
     bool isReadyToRun() const;
@@ -53,7 +70,26 @@ class SampleData {
     static const int imageSize = 20;
 
     // Preprocessing on/off
-    bool preprocess;
+    bool preprocess = false;
+    bool staffFree = false;
+
+    FeatureType featureType = PIXELS;
+    // BITS: zones per side, and bands per profile.
+    static const int zoneGrid = 5;
+    static const int profileBands = 10;
+
+    // The preprocessed sample for a crop without horizontal lines.
+    cv::Mat makePreparedSampleMatrix(const cv::Mat& lineFree,
+                                     int xcoord, int ycoord) const;
+    // Resize to imageSize and append the size/position line.
+    cv::Mat finishSampleMatrix(const cv::Mat&, int xcoord, int ycoord) const;
+    // The BITS sample of a crop: its ink (pixels darker than the crop's
+    // Otsu threshold), packed, then counted by zones. The threshold is
+    // the crop's own, as for the crops TrainKnn reads, so each sample
+    // is binarized for itself; the shorter feature is what makes BITS
+    // cheaper, at the stat model more than here.
+    cv::Mat makeBitSampleMatrix(const cv::Mat& grey,
+                                int xcoord, int ycoord) const;
 
     // accumulate features and labels in these internally.
     cv::Mat features, labels;
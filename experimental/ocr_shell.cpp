@@ -6,6 +6,8 @@
 #include <opencv2/opencv.hpp>
 
 #include "corners.hpp"
+#include "imageio.hpp"
+#include "quality.hpp"
 #include "recognition.hpp"
 #include "structured_page.hpp"
 #include "shapes.hpp"
@@ -22,7 +24,12 @@ using namespace std;
 // work. cdst is a colour version of processed, can have
 // extra markings on it in colour.
 Mat gray, focused, processed, cdst;
+// The transform from gray to focused, once the corners were found, and
+// the image it applies to (gray, normalized for lighting).
+Mat pageTransform, pageSource;
 musicocr::Sheet sheet;
+// The shapes of the sheet, segmented for the whole page by scanImage.
+std::unique_ptr<musicocr::PageShapes> pageShapes;
 cv::Ptr<cv::ml::StatModel> statModel;
 cv::Ptr<cv::ml::StatModel> fineStatModel;
 
@@ -57,6 +64,15 @@ int edHorizontalHeight = 1;
 int edVerticalSizeFudge = 30;
 int edVerticalWidth = 1;
 
+// --staff-free-samples: the models were trained on crops of the
+// staff-free page (ContourConfig::staffFreeSamples), and 't' saves
+// crops like that.
+bool staffFreeSamples = false;
+// --upright: the photos come from a fixed rig and are the right way up
+// already, so the corner finder doesn't look for a turned page
+// (CornerConfig::detectRotation).
+bool uprightPages = false;
+
 void correctConfig() {
   if (gaussianKernel % 2 == 0) {
     gaussianKernel += 1;
@@ -91,6 +107,7 @@ void makeContourConfig(musicocr::ContourConfig *config) {
 
   config->horizontalSizeFudge = edHorizontalSizeFudge;
   config->horizontalHeight = 1;
+  config->staffFreeSamples = staffFreeSamples;
 }
 
 void onTrackbar(int, void *) { }
@@ -153,14 +170,27 @@ void processImage();
 void scanImage();
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-   cerr << "OcrShell <Path to Image> [<model file name>] [<fine model file name>]";
+  // Options can go anywhere; the rest are the positional arguments.
+  vector<string> args;
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg == "--staff-free-samples") {
+      staffFreeSamples = true;
+    } else if (arg == "--upright") {
+      uprightPages = true;
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (args.empty()) {
+   cerr << "OcrShell [--staff-free-samples] [--upright] <Path to Image> "
+        << "[<model file name>] [<fine model file name>]";
    return -1; 
   }
-  filename = argv[1];
-  Mat image;
-  image = imread(filename, 1);
-  if (!image.data) {
+  filename = args[0];
+  // Everything starts with 'gray', the photo reduced to a fifth.
+  gray = musicocr::loadGrayscale(filename, 0.2);
+  if (gray.empty()) {
     cerr << "No image data.";
     return -1;
   }
@@ -171,8 +201,8 @@ int main(int argc, char** argv) {
   }
   cout << "base name of file: " << filename << endl;
 
-  if (argc > 2) {
-    const string& modelfile = argv[2];
+  if (args.size() > 1) {
+    const string& modelfile = args[1];
     // We need the type of the model because statmodel::load
     // is templatized.
     char modeltype[20];
@@ -200,8 +230,8 @@ int main(int argc, char** argv) {
       }
     }
   }
-  if (argc > 3) {
-    const string& modelfile = argv[3];
+  if (args.size() > 2) {
+    const string& modelfile = args[2];
     // We need the type of the model because statmodel::load
     // is templatized.
     char modeltype[20];
@@ -230,15 +260,21 @@ int main(int argc, char** argv) {
     }
   }
 
-  resize(image, image, Size(), 0.2, 0.2, INTER_AREA);
   namedWindow("Original Image", WINDOW_AUTOSIZE);
   namedWindow("Processed", WINDOW_AUTOSIZE);
   namedWindow("What is this?", WINDOW_AUTOSIZE);
 
-  // everything starts with 'gray'.
-  cvtColor(image, gray, COLOR_BGR2GRAY);
   imshow("Original Image", gray);
 
+  // Only a warning here, the image can still be looked at.
+  const musicocr::QualityReport quality = musicocr::QualityGate().check(gray);
+  if (!quality.usable()) {
+    cerr << filename << " is unlikely to work: " << quality.reason()
+         << " (brightness " << quality.brightness << ", contrast "
+         << quality.contrast << ", sharpness " << quality.sharpness
+         << ", ruled " << quality.ruledScore << ")" << endl;
+  }
+
   namedWindow("Controls", WINDOW_AUTOSIZE);
   setupTrackbars("Controls");
 
@@ -289,9 +325,15 @@ int main(int argc, char** argv) {
 }
 
 void findCorners() {
-  // This uses the defaults in the corner finder.
-  musicocr::CornerFinder cornerFinder;
+  // This uses the defaults in the corner finder, except with --upright.
+  // Illumination normalization stays off until the stat models are
+  // trained on normalized crops; the ones we have saw the page as it was.
+  musicocr::CornerConfig cornerConfig;
+  cornerConfig.detectRotation = !uprightPages;
+  musicocr::CornerFinder cornerFinder(cornerConfig);
   cornerFinder.adjust(gray, focused);
+  pageTransform = cornerFinder.getTransform();
+  pageSource = cornerFinder.getSource();
   focused.copyTo(processed);
   imshow("Processed", processed);
 }
@@ -308,6 +350,9 @@ void findLines() {
   imshow("Processed", cdst);
 
   cout << "creating sheet lines." << endl;
+  if (!pageTransform.empty()) {
+    sheet.setSource(pageSource, pageTransform);
+  }
 
   sheet.createSheetLines(lineContours, focused);
 
@@ -326,13 +371,21 @@ void scanImage() {
   musicocr::ContourConfig config;
   makeContourConfig(&config);
   int previousVoicePosition = 0;
+  musicocr::ScanStatistics pageStatistics;
+  // Segment the page once; lines that overlap share what is between them.
+  pageShapes.reset(new musicocr::PageShapes(config));
+  pageShapes->segment(sheet);
+  cout << pageShapes->size() << " shapes on the page, "
+       << pageShapes->getSharedCount() << " of them on two lines." << endl;
   for (size_t i = 0; i < sheet.getLineCount(); i++) {
     auto& sl = sheet.getNthLine(i);
     if (!sl.isRealMusicLine()) continue;
 
     musicocr::ShapeFinder* sf = new musicocr::ShapeFinder(config);
     sl.setShapeFinder(sf);
+    sf->setPageShapes(pageShapes.get(), i);
     sf->initLineScan(sl, statModel, fineStatModel);
+    pageStatistics.add(sf->getStatistics());
 
     int voicePosition = sf->getVoicePosition();
     cout << "line " << i << " has voice position " << voicePosition << endl;
@@ -380,6 +433,8 @@ void scanImage() {
       rectangle(cdst, sr, Scalar(0, 200, 0), 1);
     }
   }
+  cout << "page statistics: ";
+  pageStatistics.print(cout);
   imshow("Processed", cdst);
 }
 
@@ -446,8 +501,8 @@ void navigateSheet() {
         responseStream.open(responseFileName);
         musicocr::ShapeFinder shapeFinder(config);
         shapeFinder.getTrainingDataForLine(
-          processed, "Processed", "What is this?", filenameBase,
-          responseStream);
+          processed, sheet.getNthLine(lineIndex).getStaffFreeViewPort(),
+          "Processed", "What is this?", filenameBase, responseStream);
         responseStream.close();
         }
         break;
@@ -0,0 +1,53 @@
+#include "binarize.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "morphology.hpp"
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+Mat sauvolaInk(const Mat& grey, int window, double k, double range) {
+  CV_Assert(grey.type() == CV_8UC1);
+  Mat sum, squares;
+  integral(grey, sum, squares, CV_32S, CV_64F);
+  const int half = std::max(1, window) / 2;
+  Mat ink(grey.size(), CV_8UC1);
+  for (int y = 0; y < grey.rows; y++) {
+    const int top = std::max(0, y - half);
+    const int bottom = std::min(grey.rows, y + half + 1);
+    const int* sumTop = sum.ptr<int>(top);
+    const int* sumBottom = sum.ptr<int>(bottom);
+    const double* squaresTop = squares.ptr<double>(top);
+    const double* squaresBottom = squares.ptr<double>(bottom);
+    const uchar* row = grey.ptr<uchar>(y);
+    uchar* out = ink.ptr<uchar>(y);
+    for (int x = 0; x < grey.cols; x++) {
+      const int left = std::max(0, x - half);
+      const int right = std::min(grey.cols, x + half + 1);
+      const double area = (double)(bottom - top) * (right - left);
+      const double mean = (sumBottom[right] - sumTop[right]
+                           - sumBottom[left] + sumTop[left]) / area;
+      const double meanSquare = (squaresBottom[right] - squaresTop[right]
+                                 - squaresBottom[left] + squaresTop[left])
+                                / area;
+      const double deviation =
+          std::sqrt(std::max(0.0, meanSquare - mean * mean));
+      const double threshold = mean * (1.0 + k * (deviation / range - 1.0));
+      out[x] = row[x] <= threshold ? 255 : 0;
+    }
+  }
+  return ink;
+}
+
+Mat removeHorizontalInk(const Mat& ink, int width) {
+  // Opening keeps only the horizontal strokes at least width long.
+  Mat lines;
+  openRect(ink, lines, Size(width, 1));
+  return ink & ~lines;
+}
+
+}  // namespace musicocr
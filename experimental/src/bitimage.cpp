@@ -0,0 +1,96 @@
+#include "bitimage.hpp"
+
+#include <algorithm>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+inline int popcount(uint64_t word) {
+#if defined(__GNUC__)
+  return __builtin_popcountll(word);
+#else
+  word = word - ((word >> 1) & 0x5555555555555555ULL);
+  word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+  word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Bits from..63 of a word.
+inline uint64_t maskFrom(int from) { return ~0ULL << from; }
+// Bits 0..to-1 of a word, to in 1..64.
+inline uint64_t maskTo(int to) { return ~0ULL >> (64 - to); }
+
+}  // namespace
+
+BitImage::BitImage(const Mat& binary)
+  : rows(binary.rows), cols(binary.cols), wordsPerRow((binary.cols + 63) / 64),
+    words((size_t)binary.rows * wordsPerRow, 0) {
+  CV_Assert(binary.type() == CV_8UC1);
+  for (int y = 0; y < rows; y++) {
+    const uchar* row = binary.ptr<uchar>(y);
+    uint64_t* out = &words[(size_t)y * wordsPerRow];
+    for (int x = 0; x < cols; x++) {
+      if (row[x]) out[x / 64] |= 1ULL << (x % 64);
+    }
+  }
+}
+
+Mat BitImage::toMat() const {
+  Mat binary = Mat::zeros(rows, cols, CV_8UC1);
+  for (int y = 0; y < rows; y++) {
+    uchar* row = binary.ptr<uchar>(y);
+    for (int x = 0; x < cols; x++) {
+      if (at(y, x)) row[x] = 255;
+    }
+  }
+  return binary;
+}
+
+int BitImage::countInRow(int y, int from, int to) const {
+  if (from >= to) return 0;
+  const uint64_t* row = &words[(size_t)y * wordsPerRow];
+  const int first = from / 64, last = (to - 1) / 64;
+  if (first == last) {
+    return popcount(row[first] & maskFrom(from % 64) &
+                    maskTo((to - 1) % 64 + 1));
+  }
+  int n = popcount(row[first] & maskFrom(from % 64));
+  for (int w = first + 1; w < last; w++) n += popcount(row[w]);
+  return n + popcount(row[last] & maskTo((to - 1) % 64 + 1));
+}
+
+int BitImage::count(const Rect& rect) const {
+  const Rect r = rect & Rect(0, 0, cols, rows);
+  int n = 0;
+  for (int y = r.y; y < r.y + r.height; y++) {
+    n += countInRow(y, r.x, r.x + r.width);
+  }
+  return n;
+}
+
+vector<int> BitImage::zoneCounts(const Rect& rect, Size grid) const {
+  const Rect r = rect & Rect(0, 0, cols, rows);
+  vector<int> counts(grid.area(), 0);
+  if (r.area() == 0) return counts;
+  // Zone boundaries in image coordinates.
+  vector<int> xs(grid.width + 1), ys(grid.height + 1);
+  for (int i = 0; i <= grid.width; i++) xs[i] = r.x + i * r.width / grid.width;
+  for (int j = 0; j <= grid.height; j++) {
+    ys[j] = r.y + j * r.height / grid.height;
+  }
+  for (int j = 0; j < grid.height; j++) {
+    for (int y = ys[j]; y < ys[j + 1]; y++) {
+      for (int i = 0; i < grid.width; i++) {
+        counts[j * grid.width + i] += countInRow(y, xs[i], xs[i + 1]);
+      }
+    }
+  }
+  return counts;
+}
+
+}  // namespace musicocr
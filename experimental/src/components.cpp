@@ -0,0 +1,188 @@
+#include "components.hpp"
+
+#include <map>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// A horizontal run of equal pixels; end is inclusive.
+struct Run {
+  int start, end;
+  bool foreground;
+};
+
+// Running statistics for a set of runs. Only kept up to date for
+// union-find roots.
+struct Accumulator {
+  int left, top, right, bottom;
+  double area = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+  bool foreground;
+  bool touchesBorder = false;
+  // The run just left of the leftmost pixel, in the same row. This
+  // belongs to whatever encloses these runs.
+  int leftNeighbour;
+
+  Accumulator(const Run& r, int y, int cols, int rows, int leftRun)
+    : left(r.start), top(y), right(r.end), bottom(y),
+      foreground(r.foreground), leftNeighbour(leftRun) {
+    const double n = r.end - r.start + 1;
+    // Sums of x and x^2 over start..end.
+    const double s1 = n * (r.start + r.end) / 2.0;
+    const double s2 = sumOfSquares(r.end) - sumOfSquares(r.start - 1);
+    area = n;
+    sx = s1;
+    sy = n * y;
+    sxx = s2;
+    sxy = y * s1;
+    syy = n * y * y;
+    touchesBorder = (y == 0 || y == rows - 1 || r.start == 0 ||
+                     r.end == cols - 1);
+  }
+
+  static double sumOfSquares(double k) {
+    return k < 0 ? 0.0 : k * (k + 1) * (2 * k + 1) / 6.0;
+  }
+
+  void merge(const Accumulator& o) {
+    if (o.left < left) leftNeighbour = o.leftNeighbour;
+    left = std::min(left, o.left);
+    top = std::min(top, o.top);
+    right = std::max(right, o.right);
+    bottom = std::max(bottom, o.bottom);
+    area += o.area; sx += o.sx; sy += o.sy;
+    sxx += o.sxx; sxy += o.sxy; syy += o.syy;
+    touchesBorder = touchesBorder || o.touchesBorder;
+  }
+};
+
+class RunForest {
+ public:
+  int add(const Run& r, int y, int cols, int rows, int leftRun) {
+    parents.push_back(parents.size());
+    stats.emplace_back(r, y, cols, rows, leftRun);
+    return parents.size() - 1;
+  }
+
+  int find(int i) {
+    while (parents[i] != i) {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+    return i;
+  }
+
+  void unite(int a, int b) {
+    a = find(a); b = find(b);
+    if (a == b) return;
+    // Keep the older run as the root.
+    if (b < a) std::swap(a, b);
+    parents[b] = a;
+    stats[a].merge(stats[b]);
+  }
+
+  std::vector<int> parents;
+  std::vector<Accumulator> stats;
+};
+
+// Foreground is 8-connected, background 4-connected, so that holes
+// are the same as for findContours.
+bool connected(const Run& above, const Run& below) {
+  const int reach = above.foreground ? 1 : 0;
+  return above.start <= below.end + reach && above.end + reach >= below.start;
+}
+
+}  // namespace
+
+vector<ComponentStats> findComponents(const Mat& binary, bool withHoles) {
+  CV_Assert(binary.type() == CV_8UC1);
+  return findComponents(RunLengthImage(binary), withHoles);
+}
+
+vector<ComponentStats> findComponents(const RunLengthImage& binary,
+                                      bool withHoles) {
+  const int rows = binary.getRows(), cols = binary.getCols();
+  RunForest forest;
+  vector<Run> previous, current;
+  vector<int> previousIds, currentIds;
+  for (int y = 0; y < rows; y++) {
+    current.clear();
+    currentIds.clear();
+    // The foreground runs of the row, and with holes, the background
+    // runs between them.
+    auto add = [&](const Run& r) {
+      // Without holes, background runs are not in the forest.
+      const int leftRun = (withHoles && !current.empty())
+          ? currentIds.back() : -1;
+      current.push_back(r);
+      currentIds.push_back(forest.add(r, y, cols, rows, leftRun));
+    };
+    int x = 0;
+    for (const PixelRun* p = binary.rowBegin(y); p != binary.rowEnd(y); p++) {
+      if (withHoles && p->start > x) add({x, p->start - 1, false});
+      add({p->start, p->end, true});
+      x = p->end + 1;
+    }
+    if (withHoles && x < cols) add({x, cols - 1, false});
+    // Both lists are sorted by start, so one merge-like pass finds
+    // all overlapping runs.
+    size_t p = 0;
+    for (size_t c = 0; c < current.size(); c++) {
+      while (p < previous.size() &&
+             previous[p].end + 1 < current[c].start) {
+        p++;
+      }
+      for (size_t q = p; q < previous.size() &&
+           previous[q].start <= current[c].end + 1; q++) {
+        if (previous[q].foreground == current[c].foreground &&
+            connected(previous[q], current[c])) {
+          forest.unite(previousIds[q], currentIds[c]);
+        }
+      }
+    }
+    std::swap(previous, current);
+    std::swap(previousIds, currentIds);
+  }
+
+  vector<ComponentStats> components;
+  // Tree root -> index in components.
+  std::map<int, int> indices;
+  vector<int> enclosingRoots;
+  for (size_t i = 0; i < forest.parents.size(); i++) {
+    if (forest.parents[i] != (int)i) continue;
+    const Accumulator& a = forest.stats[i];
+    ComponentStats cs;
+    if (a.foreground) {
+      cs.box = Rect(Point(a.left, a.top), Point(a.right + 1, a.bottom + 1));
+    } else {
+      // Background connected to the image border is not a hole.
+      if (a.touchesBorder) continue;
+      cs.hole = true;
+      // The inner contour runs along the pixels just outside the hole.
+      cs.box = Rect(Point(a.left - 1, a.top - 1),
+                    Point(a.right + 2, a.bottom + 2));
+    }
+    cs.area = (int)a.area;
+    cs.m00 = a.area;
+    cs.m10 = a.sx; cs.m01 = a.sy;
+    cs.m20 = a.sxx; cs.m11 = a.sxy; cs.m02 = a.syy;
+    cs.centroid = Point2d(a.sx / a.area, a.sy / a.area);
+    indices.emplace(i, components.size());
+    enclosingRoots.push_back(
+        a.leftNeighbour >= 0 ? forest.find(a.leftNeighbour) : -1);
+    components.push_back(cs);
+  }
+  // Components are enclosed by holes, and holes by components. The
+  // background around everything is not reported, so components in it
+  // keep parent -1.
+  for (size_t i = 0; i < components.size(); i++) {
+    const auto p = indices.find(enclosingRoots[i]);
+    if (p != indices.end()) components[i].parent = p->second;
+  }
+  return components;
+}
+
+}  // namespace musicocr
@@ -1,4 +1,6 @@
 #include "corners.hpp"
+#include "hough.hpp"
+#include "illumination.hpp"
 #include "utils.hpp"
 #include <algorithm>
 #include <cmath>
@@ -10,8 +12,17 @@ using namespace std;
 using namespace cv;
 
 std::vector<cv::Vec4i> CornerFinder::find_lines(const cv::Mat& image) const {
+  return findLinesAtLevel(image, 0);
+}
+
+std::vector<cv::Vec4i> CornerFinder::findLinesAtLevel(const cv::Mat& image,
+                                                      int level) const {
+  // Every pyrDown halves the image. Lengths shrink with it, and the
+  // gradients Canny looks at get steeper.
+  const int factor = 1 << level;
+  const int kernel = std::max(3, cvRound(15.0 / factor) | 1);
   Mat tmp;
-  GaussianBlur(image, tmp, Size(15, 15), 0, 0);
+  GaussianBlur(image, tmp, Size(kernel, kernel), 0, 0);
 
   // This isn't terribly different from running Canny.
   cv::Mat gradX, gradY, absGradX, absGradY;
@@ -21,25 +32,49 @@ std::vector<cv::Vec4i> CornerFinder::find_lines(const cv::Mat& image) const {
   cv::convertScaleAbs(gradY, absGradY);
   cv::addWeighted(absGradX, 0.5, absGradY, 0.5, 0, tmp);
 
-  Canny(tmp, tmp, 60, 114, config.sobelKernel,
+  Canny(tmp, tmp, 60 * factor, 114 * factor, config.sobelKernel,
         config.l2gradient);
   vector<Vec4i> lines;
-  HoughLinesP(tmp, lines, 1, CV_PI/180.0, 100, 50, config.houghMaxLineGap);
+  houghLines(tmp, lines, std::max(1, cvRound(100.0 / factor)),
+             std::max(1, cvRound(50.0 / factor)),
+             std::max(1, cvRound((double)config.houghMaxLineGap / factor)));
   tmp.release();
 
   return lines;
 }
 
+void CornerFinder::houghLines(const cv::Mat& edges, vector<Vec4i>& lines,
+                              int threshold, int minLineLength,
+                              int maxLineGap) const {
+  if (config.bandedHough) {
+    houghLinesBanded(edges, lines, 1, CV_PI/180.0, threshold, minLineLength,
+                     maxLineGap, config.houghBandDegrees);
+  } else {
+    HoughLinesP(edges, lines, 1, CV_PI/180.0, threshold, minLineLength,
+                maxLineGap);
+  }
+}
+
 bool CornerFinder::shouldRotate(const cv::Mat& image) const {
+  return shouldRotateAtLevel(image, 0);
+}
+
+bool CornerFinder::shouldRotateAtLevel(const cv::Mat& image,
+                                       int level) const {
+  // As in findLinesAtLevel, but Canny runs on the equalized image, whose
+  // gradients don't depend on the scale, so its thresholds stay.
+  const int factor = 1 << level;
+  const int kernel = (config.gaussianKernel / factor) | 1;
   Mat tmp;
-  GaussianBlur(image, tmp, Size(config.gaussianKernel, config.gaussianKernel),
-               0, 0);
+  GaussianBlur(image, tmp, Size(kernel, kernel), 0, 0);
   equalizeHist(tmp, tmp);
   Canny(tmp, tmp, config.cannyMin, config.cannyMax, config.sobelKernel,
         config.l2gradient);
   vector<Vec4i> lines;
-  HoughLinesP(tmp, lines, 1, CV_PI/180.0, config.houghThreshold,
-               config.houghMinLinLength, config.houghMaxLineGap);
+  houghLines(tmp, lines,
+             std::max(1, cvRound((double)config.houghThreshold / factor)),
+             std::max(1, cvRound((double)config.houghMinLinLength / factor)),
+             std::max(1, cvRound((double)config.houghMaxLineGap / factor)));
   tmp.release();
   return !mostLinesAreHorizontal(lines);
 }
@@ -121,11 +156,11 @@ cv::Vec4i CornerFinder::getOutline(std::vector<cv::Vec4i>& lines,
   return {lines[0][0], lines[0][1], lastX, lastY};
 }
 
-std::vector<cv::Point> CornerFinder::find_corners(
-    const std::vector<cv::Vec4i>& lines, int width, int height) const {
-  std::vector<cv::Vec4i> bottomLines, topLines,
-                         leftLines, rightLines;
-
+void CornerFinder::sortOutlineCandidates(
+    const std::vector<cv::Vec4i>& lines, int width, int height,
+    std::vector<cv::Vec4i>& topLines, std::vector<cv::Vec4i>& bottomLines,
+    std::vector<cv::Vec4i>& leftLines,
+    std::vector<cv::Vec4i>& rightLines) const {
   const float thirdHeight = (float)height / 3.0;
   const float bottomThird = (float)height - thirdHeight;
   const float thirdWidth = (float)width / 3.0;
@@ -147,6 +182,15 @@ std::vector<cv::Point> CornerFinder::find_corners(
       }
     }
   }
+}
+
+std::vector<cv::Point> CornerFinder::find_corners(
+    const std::vector<cv::Vec4i>& lines, int width, int height) const {
+  std::vector<cv::Vec4i> bottomLines, topLines,
+                         leftLines, rightLines;
+
+  sortOutlineCandidates(lines, width, height, topLines, bottomLines,
+                        leftLines, rightLines);
 
   cv::Vec4i topLine, bottomLine, leftLine, rightLine;
   topLine = getOutline(topLines, 0, width, height); 
@@ -190,6 +234,118 @@ std::vector<cv::Point> CornerFinder::find_corners(
   return {topLeft, topRight, bottomRight, bottomLeft};
 }
 
+std::vector<cv::Point> CornerFinder::find_corners_coarse_to_fine(
+    const cv::Mat& image) const {
+  Mat reduced = image;
+  for (int i = 0; i < config.pyramidLevels; i++) {
+    Mat tmp;
+    pyrDown(reduced, tmp);
+    reduced = tmp;
+  }
+  // The segments of the reduced image, at full resolution.
+  const int factor = 1 << config.pyramidLevels;
+  std::vector<cv::Vec4i> lines =
+      findLinesAtLevel(reduced, config.pyramidLevels);
+  for (auto& line : lines) {
+    for (int k = 0; k < 4; k++) line[k] *= factor;
+  }
+
+  // A side that the reduced image has no candidates for may still have
+  // some at full resolution (the paper's edge is faint, or close to the
+  // border of the picture), and there is no telling where. Look at the
+  // whole image then.
+  std::vector<cv::Vec4i> top, bottom, left, right;
+  sortOutlineCandidates(lines, image.cols, image.rows, top, bottom, left,
+                        right);
+  if (top.empty() || bottom.empty() || left.empty() || right.empty()) {
+    return find_corners(find_lines(image), image.cols, image.rows);
+  }
+
+  // Otherwise look for each side again at full resolution, from the
+  // border of the image to cornerRefineRadius past both the outline the
+  // reduced image gives and its outermost candidate for that side, and
+  // snap the corners of those outlines to the paper's corners.
+  const std::vector<cv::Point> coarse =
+      find_corners(lines, image.cols, image.rows);
+  const int radius = config.cornerRefineRadius;
+  auto outermost = [](const std::vector<cv::Vec4i>& candidates, int index,
+                      bool smallest) {
+    int value = candidates[0][index];
+    for (const auto& c : candidates) {
+      value = smallest ? std::min(value, c[index]) : std::max(value, c[index]);
+    }
+    return value;
+  };
+  const int topEnd = std::min(image.rows, radius +
+      std::max({coarse[0].y, coarse[1].y, outermost(top, 1, true)}));
+  const int bottomStart = std::max(0, -radius +
+      std::min({coarse[3].y, coarse[2].y, outermost(bottom, 1, false)}));
+  const int leftEnd = std::min(image.cols, radius +
+      std::max({coarse[0].x, coarse[3].x, outermost(left, 0, true)}));
+  const int rightStart = std::max(0, -radius +
+      std::min({coarse[1].x, coarse[2].x, outermost(right, 0, false)}));
+  std::vector<cv::Vec4i> refined;
+  findLinesInBand(image, Rect(0, 0, image.cols, topEnd), 1, refined);
+  findLinesInBand(image, Rect(0, bottomStart, image.cols,
+                              image.rows - bottomStart), 1, refined);
+  findLinesInBand(image, Rect(0, 0, leftEnd, image.rows), 0, refined);
+  findLinesInBand(image, Rect(rightStart, 0, image.cols - rightStart,
+                              image.rows), 0, refined);
+  std::vector<cv::Point> corners =
+      find_corners(refined, image.cols, image.rows);
+  refineCorners(image, corners);
+  return corners;
+}
+
+void CornerFinder::findLinesInBand(const cv::Mat& image, const cv::Rect& band,
+                                   short horizontal,
+                                   std::vector<cv::Vec4i>& lines) const {
+  if (band.area() == 0) return;
+  // With enough around the band for the 15x15 blur and the Sobel
+  // filters of find_lines not to see the border of the crop.
+  const int margin = 8;
+  const Rect grown = Rect(band.x - margin, band.y - margin,
+                          band.width + 2 * margin, band.height + 2 * margin)
+                     & Rect(0, 0, image.cols, image.rows);
+  for (const auto& line : find_lines(image(grown))) {
+    const Vec4i shifted(line[0] + grown.x, line[1] + grown.y,
+                        line[2] + grown.x, line[3] + grown.y);
+    if (lineIsHorizontal(shifted) != horizontal ||
+        !band.contains(Point(shifted[0], shifted[1]))) {
+      continue;
+    }
+    lines.push_back(shifted);
+  }
+}
+
+void CornerFinder::refineCorners(const cv::Mat& image,
+                                 std::vector<cv::Point>& corners) const {
+  // Corners on the border of the image come from snapping or from
+  // extending the outlines, there is no corner in the image to move to.
+  std::vector<cv::Point2f> inside;
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < corners.size(); i++) {
+    const Point& c = corners[i];
+    if (c.x > 0 && c.x < image.cols && c.y > 0 && c.y < image.rows) {
+      inside.push_back(Point2f(c));
+      indices.push_back(i);
+    }
+  }
+  if (inside.empty()) return;
+
+  const int radius = config.cornerRefineRadius;
+  cornerSubPix(image, inside, Size(radius, radius), Size(-1, -1),
+               TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 20, 0.1));
+  for (size_t k = 0; k < inside.size(); k++) {
+    const Point refined(cvRound(inside[k].x), cvRound(inside[k].y));
+    Point& corner = corners[indices[k]];
+    if (std::abs(refined.x - corner.x) <= radius &&
+        std::abs(refined.y - corner.y) <= radius) {
+      corner = refined;
+    }
+  }
+}
+
 
 // Decide if most (actually, at least half) of the lines are horizontal.
 // This is intended to be used on the output of a hough lines detection that
@@ -212,24 +368,128 @@ bool CornerFinder::mostLinesAreHorizontal(const std::vector<cv::Vec4i>& lines) {
   return horizontalCount >= verticalCount;
 }
 
-void CornerFinder::adjustToCorners(const cv::Mat& image, cv::Mat& warp,
-                     const std::vector<cv::Point>& corners) {
+cv::Mat CornerFinder::getPageTransform(const std::vector<cv::Point>& corners,
+                                       cv::Size size) {
   Point2f source[4] = {Point2f(corners[0]), Point2f(corners[1]), Point2f(corners[2]),
                     Point2f(corners[3])};
-  Point2f target[4] = {Point2f(0.0, 0.0), Point2f(image.cols, 0.0),
-                    Point2f(image.cols, image.rows), Point2f(0.0, image.rows)};
+  Point2f target[4] = {Point2f(0.0, 0.0), Point2f(size.width, 0.0),
+                    Point2f(size.width, size.height), Point2f(0.0, size.height)};
 
-  Mat lambda = getPerspectiveTransform(source, target);
+  return getPerspectiveTransform(source, target);
+}
+
+void CornerFinder::adjustToCorners(const cv::Mat& image, cv::Mat& warp,
+                     const std::vector<cv::Point>& corners) {
+  Mat lambda = getPageTransform(corners, image.size());
   warpPerspective(image, warp, lambda, warp.size());
 }
 
+std::vector<float> CornerFinder::outlineProfiles(
+    const cv::Mat& image, const std::vector<cv::Point>& corners) const {
+  const int radius = config.reuseProfileRadius;
+  const Rect inside(radius + 1, radius + 1, image.cols - 2 * radius - 2,
+                    image.rows - 2 * radius - 2);
+  std::vector<float> profiles;
+  for (size_t i = 0; i < corners.size(); i++) {
+    const Point2f from(corners[i]);
+    const Point2f to(corners[(i + 1) % corners.size()]);
+    const float length = (float)norm(to - from);
+    if (length < 1.0f) continue;
+    const Point2f along = (to - from) * (1.0f / length);
+    const Point2f across(-along.y, along.x);
+    for (float t = 0.0f; t <= length; t += config.reuseSampleStep) {
+      const Point2f p = from + along * t;
+      if (!inside.contains(Point(cvRound(p.x), cvRound(p.y)))) continue;
+      const size_t start = profiles.size();
+      float sum = 0.0f;
+      for (int k = -radius; k <= radius; k++) {
+        const Point q(cvRound(p.x + across.x * k), cvRound(p.y + across.y * k));
+        profiles.push_back(image.at<uchar>(q));
+        sum += profiles.back();
+      }
+      const float mean = sum / (2 * radius + 1);
+      for (size_t j = start; j < profiles.size(); j++) profiles[j] -= mean;
+    }
+  }
+  return profiles;
+}
+
+bool CornerFinder::pageUnchanged(const cv::Mat& image) const {
+  if (cachedCorners.empty() || image.size() != cachedSize) return false;
+  const std::vector<float> profiles = outlineProfiles(image, cachedCorners);
+  // Only profiles that cross an edge in the cached page tell whether the
+  // page moved. Without enough of those (the paper fills the picture,
+  // say), don't take the risk.
+  const int minContrast = 20;
+  const int minProfiles = 8;
+  const size_t width = 2 * config.reuseProfileRadius + 1;
+  double difference = 0.0;
+  int count = 0;
+  for (size_t start = 0; start + width <= profiles.size(); start += width) {
+    const auto first = cachedProfiles.begin() + start;
+    const auto range = std::minmax_element(first, first + width);
+    if (*range.second - *range.first < minContrast) continue;
+    for (size_t k = start; k < start + width; k++) {
+      difference += std::abs(profiles[k] - cachedProfiles[k]);
+    }
+    count++;
+  }
+  if (count < minProfiles) return false;
+  return difference / (count * width) <= config.reuseTolerance;
+}
+
+cv::Mat CornerFinder::warpReduced(const cv::Mat& image, int level) const {
+  const double scale = 1.0 / (1 << level);
+  const Mat reduce = (Mat_<double>(3, 3) << scale, 0, 0,
+                                            0, scale, 0,
+                                            0, 0, 1);
+  Mat reduced;
+  warpPerspective(image, reduced, reduce * transform,
+                  Size(cvCeil(image.cols * scale), cvCeil(image.rows * scale)));
+  return reduced;
+}
+
 void CornerFinder::adjust(const cv::Mat& image, cv::Mat& target) {
-  std::vector<cv::Vec4i> lines = find_lines(image);
-  std::vector<cv::Point> corners = find_corners(lines, image.cols, image.rows); 
-  adjustToCorners(image, target, corners);
-  if (shouldRotate(target)) {
-    cv::rotate(target, target, cv::ROTATE_90_COUNTERCLOCKWISE);
+  reused = config.reuseCorners && pageUnchanged(image);
+  std::vector<cv::Point> corners;
+  if (reused) {
+    corners = cachedCorners;
+  } else if (config.pyramidLevels > 0) {
+    corners = find_corners_coarse_to_fine(image);
+  } else {
+    std::vector<cv::Vec4i> lines = find_lines(image);
+    corners = find_corners(lines, image.cols, image.rows);
+  }
+  transform = getPageTransform(corners, image.size());
+  source = config.normalizeIllumination
+      ? normalizeIllumination(image, config.illuminationScale,
+                              config.illuminationKernel)
+      : image;
+  // The rotation is decided on the warped page: the segments find_lines
+  // has are the page outline, which says nothing about which way the
+  // music runs. Only the long lines count, so a reduced warp will do.
+  bool rotate = cachedRotate;
+  if (!reused) {
+    rotate = config.detectRotation && shouldRotateAtLevel(
+        warpReduced(source, config.rotationLevel), config.rotationLevel);
+  }
+  if (config.reuseCorners && !reused) {
+    cachedCorners = corners;
+    cachedProfiles = outlineProfiles(image, corners);
+    cachedSize = image.size();
+    cachedRotate = rotate;
+  }
+  Size size = image.size();
+  if (rotate) {
+    // Same as cv::rotate(ROTATE_90_COUNTERCLOCKWISE) after warping:
+    // (x, y) goes to (y, width - 1 - x).
+    const Mat rotation = (Mat_<double>(3, 3) << 0, 1, 0,
+                                                -1, 0, size.width - 1,
+                                                0, 0, 1);
+    transform = rotation * transform;
+    size = Size(size.height, size.width);
   }
+  warpPerspective(source, target, transform, size);
 }
 
 } // namespace musicocr
@@ -0,0 +1,183 @@
+#include "hough.hpp"
+
+#include <cmath>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// Voting for one point: the rho bin of the point for every angle.
+class Voter {
+ public:
+  Voter(const vector<float>& cosines, const vector<float>& sines,
+        int rhoOffset)
+    : cosines(cosines), sines(sines), offset(rhoOffset),
+      bins(cosines.size()) {}
+
+  // Fills in bins for the point (x, y), the same values as
+  // cvRound(x * cos + y * sin) + offset.
+  const vector<int>& compute(int x, int y) {
+    const int n = cosines.size();
+    int i = 0;
+#if CV_SIMD128
+    const v_float32x4 vx = v_setall_f32((float)x);
+    const v_float32x4 vy = v_setall_f32((float)y);
+    const v_int32x4 voffset = v_setall_s32(offset);
+    for (; i <= n - v_float32x4::nlanes; i += v_float32x4::nlanes) {
+      const v_float32x4 r = v_muladd(vx, v_load(cosines.data() + i),
+                                     vy * v_load(sines.data() + i));
+      v_store(bins.data() + i, v_round(r) + voffset);
+    }
+#endif
+    for (; i < n; i++) {
+      bins[i] = cvRound(x * cosines[i] + y * sines[i]) + offset;
+    }
+    return bins;
+  }
+
+ private:
+  const vector<float>& cosines;
+  const vector<float>& sines;
+  const int offset;
+  vector<int> bins;
+};
+
+}  // namespace
+
+void houghLinesBanded(const Mat& edges, vector<Vec4i>& lines,
+                      double rho, double theta, int threshold,
+                      int minLineLength, int maxLineGap,
+                      double bandDegrees) {
+  CV_Assert(edges.type() == CV_8UC1);
+  lines.clear();
+  const int width = edges.cols;
+  const int height = edges.rows;
+  const float irho = 1.0f / (float)rho;
+
+  // The angles to vote for: within the band around 0, 90 and 180
+  // degrees (lines with normals near 180 degrees are vertical, too).
+  const double band = bandDegrees * CV_PI / 180.0;
+  const int allAngles = cvRound(CV_PI / theta);
+  vector<float> cosines, sines;
+  for (int n = 0; n < allAngles; n++) {
+    const double angle = n * theta;
+    const double distance = std::min(std::min(angle,
+        std::abs(angle - CV_PI / 2.0)), CV_PI - angle);
+    if (distance > band) continue;
+    cosines.push_back((float)(cos(angle) * irho));
+    sines.push_back((float)(sin(angle) * irho));
+  }
+  const int numangle = cosines.size();
+  if (numangle == 0) return;
+  const int numrho = cvRound(((width + height) * 2 + 1) / rho);
+  // One row of rho bins per angle.
+  Mat accumulator = Mat::zeros(numangle, numrho, CV_32SC1);
+  Voter voter(cosines, sines, (numrho - 1) / 2);
+
+  // Edge points, in the order they will be visited, and a mask of the
+  // ones that are not part of a line yet.
+  Mat mask(height, width, CV_8UC1);
+  vector<Point> points;
+  for (int y = 0; y < height; y++) {
+    const uchar* row = edges.ptr<uchar>(y);
+    uchar* maskRow = mask.ptr<uchar>(y);
+    for (int x = 0; x < width; x++) {
+      maskRow[x] = row[x] ? 1 : 0;
+      if (row[x]) points.emplace_back(x, y);
+    }
+  }
+
+  // Same fixed seed as HoughLinesP, so results are repeatable.
+  RNG rng((uint64)-1);
+  const int shift = 16;
+  for (int count = points.size(); count > 0; count--) {
+    // Pick a random point out of the remaining ones.
+    const int idx = rng.uniform(0, count);
+    const Point point = points[idx];
+    points[idx] = points[count - 1];
+    // Already part of some other line?
+    if (!mask.at<uchar>(point)) continue;
+
+    // Vote, and find the most likely line through the point.
+    const vector<int>& bins = voter.compute(point.x, point.y);
+    int maxVal = threshold - 1, maxN = 0;
+    for (int n = 0; n < numangle; n++) {
+      const int val = ++accumulator.at<int>(n, bins[n]);
+      if (maxVal < val) {
+        maxVal = val;
+        maxN = n;
+      }
+    }
+    if (maxVal < threshold) continue;
+
+    // Walk from the point along the line in both directions, in fixed
+    // point, to find the ends of the segment.
+    const float a = -sines[maxN];
+    const float b = cosines[maxN];
+    int x0 = point.x, y0 = point.y, dx0, dy0;
+    const bool xflag = std::abs(a) > std::abs(b);
+    if (xflag) {
+      dx0 = a > 0 ? 1 : -1;
+      dy0 = cvRound(b * (1 << shift) / std::abs(a));
+      y0 = (y0 << shift) + (1 << (shift - 1));
+    } else {
+      dy0 = b > 0 ? 1 : -1;
+      dx0 = cvRound(a * (1 << shift) / std::abs(b));
+      x0 = (x0 << shift) + (1 << (shift - 1));
+    }
+    auto pixelAt = [&](int x, int y) {
+      return xflag ? Point(x, y >> shift) : Point(x >> shift, y);
+    };
+
+    Point lineEnd[2];
+    for (int k = 0; k < 2; k++) {
+      int gap = 0;
+      const int dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+      for (int x = x0, y = y0;; x += dx, y += dy) {
+        const Point p = pixelAt(x, y);
+        if (p.x < 0 || p.x >= width || p.y < 0 || p.y >= height) break;
+        if (mask.at<uchar>(p)) {
+          gap = 0;
+          lineEnd[k] = p;
+        } else if (++gap > maxLineGap) {
+          break;
+        }
+      }
+    }
+
+    const bool goodLine =
+        std::abs(lineEnd[1].x - lineEnd[0].x) >= minLineLength ||
+        std::abs(lineEnd[1].y - lineEnd[0].y) >= minLineLength;
+
+    // Take the segment's points out of the mask, and if it is a line,
+    // their votes out of the accumulator.
+    for (int k = 0; k < 2; k++) {
+      const int dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+      for (int x = x0, y = y0;; x += dx, y += dy) {
+        const Point p = pixelAt(x, y);
+        uchar& m = mask.at<uchar>(p);
+        if (m) {
+          if (goodLine) {
+            const vector<int>& unvote = voter.compute(p.x, p.y);
+            for (int n = 0; n < numangle; n++) {
+              accumulator.at<int>(n, unvote[n])--;
+            }
+          }
+          m = 0;
+        }
+        if (p == lineEnd[k]) break;
+      }
+    }
+
+    if (goodLine) {
+      lines.emplace_back(lineEnd[0].x, lineEnd[0].y,
+                         lineEnd[1].x, lineEnd[1].y);
+    }
+  }
+}
+
+}  // namespace musicocr
@@ -0,0 +1,37 @@
+#include "illumination.hpp"
+
+#include <algorithm>
+
+#include "morphology.hpp"
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+Mat estimateBackground(const Mat& grey, int scale, int kernel) {
+  CV_Assert(grey.type() == CV_8UC1);
+  scale = std::max(1, scale);
+  const Size reduced(std::max(1, grey.cols / scale),
+                     std::max(1, grey.rows / scale));
+  Mat small;
+  resize(grey, small, reduced, 0, 0, INTER_AREA);
+  closeRect(small, small, Size(kernel, kernel));
+  medianBlur(small, small, 5);
+  Mat background;
+  resize(small, background, grey.size(), 0, 0, INTER_LINEAR);
+  return background;
+}
+
+Mat normalizeIllumination(const Mat& grey, const Mat& background) {
+  CV_Assert(grey.size() == background.size());
+  Mat normalized;
+  divide(grey, background, normalized, 255.0);
+  return normalized;
+}
+
+Mat normalizeIllumination(const Mat& grey, int scale, int kernel) {
+  return normalizeIllumination(grey, estimateBackground(grey, scale, kernel));
+}
+
+}  // namespace musicocr
@@ -0,0 +1,107 @@
+#include "imageio.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+uint16_t readShort(const unsigned char* p, bool littleEndian) {
+  return littleEndian ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+}
+
+uint32_t readLong(const unsigned char* p, bool littleEndian) {
+  return littleEndian
+      ? p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)
+      : ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// The orientation tag in the TIFF structure of an EXIF segment, 0 if
+// there is none.
+int orientationInTiff(const vector<unsigned char>& tiff) {
+  if (tiff.size() < 8) return 0;
+  bool littleEndian;
+  if (tiff[0] == 'I' && tiff[1] == 'I') {
+    littleEndian = true;
+  } else if (tiff[0] == 'M' && tiff[1] == 'M') {
+    littleEndian = false;
+  } else {
+    return 0;
+  }
+  // In size_t, so that a bogus offset near 4G can't wrap around below.
+  const size_t ifd = readLong(&tiff[4], littleEndian);
+  if (ifd + 2 > tiff.size()) return 0;
+  const int entries = readShort(&tiff[ifd], littleEndian);
+  for (int i = 0; i < entries; i++) {
+    const size_t entry = ifd + 2 + 12 * (size_t)i;
+    if (entry + 12 > tiff.size()) return 0;
+    if (readShort(&tiff[entry], littleEndian) != 0x0112) continue;
+    // A SHORT, stored at the start of the value field.
+    const int orientation = readShort(&tiff[entry + 8], littleEndian);
+    return orientation >= 1 && orientation <= 8 ? orientation : 0;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int reducedReadFlag(double scale, int* reduction) {
+  // The largest reduction that still leaves at least scale.
+  int r = 1;
+  while (r < 8 && scale * r * 2 <= 1.0) r *= 2;
+  *reduction = r;
+  switch (r) {
+    case 2: return IMREAD_REDUCED_GRAYSCALE_2;
+    case 4: return IMREAD_REDUCED_GRAYSCALE_4;
+    case 8: return IMREAD_REDUCED_GRAYSCALE_8;
+    default: return IMREAD_GRAYSCALE;
+  }
+}
+
+Mat loadGrayscale(const string& filename, double scale) {
+  CV_Assert(scale > 0.0 && scale <= 1.0);
+  int reduction;
+  Mat image = imread(filename, reducedReadFlag(scale, &reduction));
+  const double rest = scale * reduction;
+  if (!image.empty() && rest < 1.0) {
+    resize(image, image, Size(), rest, rest, INTER_AREA);
+  }
+  return image;
+}
+
+int readExifOrientation(const string& filename) {
+  ifstream in(filename, ios::binary);
+  unsigned char marker[4];
+  if (!in.read((char*)marker, 2) || marker[0] != 0xFF || marker[1] != 0xD8) {
+    return 0;
+  }
+  // The segments before the image data: marker, then a big-endian
+  // length that includes itself.
+  while (in.read((char*)marker, 4) && marker[0] == 0xFF) {
+    const int length = (marker[2] << 8) | marker[3];
+    // Start of scan: the image data follows, no more metadata.
+    if (marker[1] == 0xDA || length < 2) return 0;
+    if (marker[1] != 0xE1) {
+      in.seekg(length - 2, ios::cur);
+      continue;
+    }
+    vector<unsigned char> segment(length - 2);
+    if (!in.read((char*)segment.data(), segment.size())) return 0;
+    static const char exif[] = "Exif\0";
+    if (segment.size() < 6 || !std::equal(exif, exif + 6, segment.begin())) {
+      continue;
+    }
+    return orientationInTiff(
+        vector<unsigned char>(segment.begin() + 6, segment.end()));
+  }
+  return 0;
+}
+
+}  // namespace musicocr
@@ -0,0 +1,255 @@
+#include "morphology.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// The two operations, with the value that pixels outside the image
+// take (which makes them drop out of the result, as with the default
+// border of cv::dilate/cv::erode).
+struct MaxOp {
+  static uchar identity() { return 0; }
+  static uchar apply(uchar a, uchar b) { return std::max(a, b); }
+#if CV_SIMD128
+  static v_uint8x16 apply(const v_uint8x16& a, const v_uint8x16& b) {
+    return v_max(a, b);
+  }
+#endif
+};
+
+struct MinOp {
+  static uchar identity() { return 255; }
+  static uchar apply(uchar a, uchar b) { return std::min(a, b); }
+#if CV_SIMD128
+  static v_uint8x16 apply(const v_uint8x16& a, const v_uint8x16& b) {
+    return v_min(a, b);
+  }
+#endif
+};
+
+// out[i] = op(a[i], b[i]) for i < n.
+template<typename Op>
+void combine(const uchar* a, const uchar* b, uchar* out, int n) {
+  int i = 0;
+#if CV_SIMD128
+  for (; i <= n - v_uint8x16::nlanes; i += v_uint8x16::nlanes) {
+    v_store(out + i, Op::apply(v_load(a + i), v_load(b + i)));
+  }
+#endif
+  for (; i < n; i++) out[i] = Op::apply(a[i], b[i]);
+}
+
+#if CV_SIMD128
+// Transposes the 16x16 bytes of v, v[r] being row r. Four rounds of
+// interleaving each row with the one 8 further on.
+void transpose16(v_uint8x16* v) {
+  for (int round = 0; round < 4; round++) {
+    v_uint8x16 out[16];
+    for (int i = 0; i < 8; i++) {
+      v_zip(v[i], v[i + 8], out[2 * i], out[2 * i + 1]);
+    }
+    std::copy(out, out + 16, v);
+  }
+}
+#endif
+
+// Running min/max over windows of width pixels along each row.
+//
+// With the row padded so that window x starts at padded index x, split
+// the padded row into blocks of width. forward[j] is the result over
+// the start of j's block up to j, backward[j] from j to the end of its
+// block. A window spans at most two blocks, so its result is
+// op(backward[x], forward[x + width - 1]): three operations per pixel
+// whatever the width.
+//
+// The recurrences go from pixel to pixel, so along one row they can't
+// be vectorised. With SIMD, groups of rows are interleaved instead, a
+// vector holding the same pixel of each row, and the recurrences step
+// over those vectors. Rows left over go one at a time.
+template<typename Op>
+void rowPass(const Mat& src, Mat& dst, int width) {
+  const int anchor = width / 2;
+  const int n = src.cols;
+  const int length = n + width - 1;
+  int y = 0;
+#if CV_SIMD128
+  const int lanes = v_uint8x16::nlanes;
+  vector<uchar> lanePadded(length * lanes, Op::identity());
+  vector<uchar> laneForward(length * lanes), laneBackward(length * lanes);
+  vector<uchar> laneResult(n * lanes);
+  for (; y + lanes <= src.rows; y += lanes) {
+    uchar* interleaved = lanePadded.data() + anchor * lanes;
+    int x = 0;
+    v_uint8x16 block[16];
+    for (; x + lanes <= n; x += lanes) {
+      for (int r = 0; r < lanes; r++) {
+        block[r] = v_load(src.ptr<uchar>(y + r) + x);
+      }
+      transpose16(block);
+      for (int c = 0; c < lanes; c++) {
+        v_store(interleaved + (x + c) * lanes, block[c]);
+      }
+    }
+    for (; x < n; x++) {
+      for (int r = 0; r < lanes; r++) {
+        interleaved[x * lanes + r] = src.ptr<uchar>(y + r)[x];
+      }
+    }
+    const uchar* padded = lanePadded.data();
+    uchar* forward = laneForward.data();
+    uchar* backward = laneBackward.data();
+    for (int start = 0; start < length; start += width) {
+      const int end = std::min(start + width, length) - 1;
+      v_uint8x16 f = v_load(padded + start * lanes);
+      v_store(forward + start * lanes, f);
+      for (int j = start + 1; j <= end; j++) {
+        f = Op::apply(f, v_load(padded + j * lanes));
+        v_store(forward + j * lanes, f);
+      }
+      v_uint8x16 b = v_load(padded + end * lanes);
+      v_store(backward + end * lanes, b);
+      for (int j = end - 1; j >= start; j--) {
+        b = Op::apply(b, v_load(padded + j * lanes));
+        v_store(backward + j * lanes, b);
+      }
+    }
+    combine<Op>(backward, forward + (width - 1) * lanes, laneResult.data(),
+                n * lanes);
+    for (x = 0; x + lanes <= n; x += lanes) {
+      for (int c = 0; c < lanes; c++) {
+        block[c] = v_load(laneResult.data() + (x + c) * lanes);
+      }
+      transpose16(block);
+      for (int r = 0; r < lanes; r++) {
+        v_store(dst.ptr<uchar>(y + r) + x, block[r]);
+      }
+    }
+    for (; x < n; x++) {
+      for (int r = 0; r < lanes; r++) {
+        dst.ptr<uchar>(y + r)[x] = laneResult[x * lanes + r];
+      }
+    }
+  }
+#endif
+  vector<uchar> padded(length, Op::identity());
+  vector<uchar> forward(length), backward(length);
+  for (; y < src.rows; y++) {
+    std::copy(src.ptr<uchar>(y), src.ptr<uchar>(y) + n,
+              padded.begin() + anchor);
+    for (int start = 0; start < length; start += width) {
+      const int end = std::min(start + width, length) - 1;
+      forward[start] = padded[start];
+      for (int j = start + 1; j <= end; j++) {
+        forward[j] = Op::apply(forward[j - 1], padded[j]);
+      }
+      backward[end] = padded[end];
+      for (int j = end - 1; j >= start; j--) {
+        backward[j] = Op::apply(backward[j + 1], padded[j]);
+      }
+    }
+    combine<Op>(backward.data(), forward.data() + width - 1,
+                dst.ptr<uchar>(y), n);
+  }
+}
+
+// The same along columns. Here the recurrences go from row to row, so
+// every step is a whole-row operation.
+template<typename Op>
+void columnPass(const Mat& src, Mat& dst, int height) {
+  const int anchor = height / 2;
+  const int n = src.cols;
+  const int length = src.rows + height - 1;
+  const vector<uchar> border(n, Op::identity());
+  auto padded = [&](int j) {
+    const int y = j - anchor;
+    return (y >= 0 && y < src.rows) ? src.ptr<uchar>(y) : border.data();
+  };
+  Mat forward(length, n, CV_8UC1), backward(length, n, CV_8UC1);
+  for (int j = 0; j < length; j++) {
+    if (j % height == 0) {
+      std::copy(padded(j), padded(j) + n, forward.ptr<uchar>(j));
+    } else {
+      combine<Op>(forward.ptr<uchar>(j - 1), padded(j),
+                  forward.ptr<uchar>(j), n);
+    }
+  }
+  for (int j = length - 1; j >= 0; j--) {
+    if (j == length - 1 || j % height == height - 1) {
+      std::copy(padded(j), padded(j) + n, backward.ptr<uchar>(j));
+    } else {
+      combine<Op>(backward.ptr<uchar>(j + 1), padded(j),
+                  backward.ptr<uchar>(j), n);
+    }
+  }
+  for (int y = 0; y < src.rows; y++) {
+    combine<Op>(backward.ptr<uchar>(y), forward.ptr<uchar>(y + height - 1),
+                dst.ptr<uchar>(y), n);
+  }
+}
+
+template<typename Op>
+void rectOp(const Mat& src, Mat& dst, Size size) {
+  const int width = std::max(1, size.width);
+  const int height = std::max(1, size.height);
+  Mat rows(src.size(), CV_8UC1);
+  if (width > 1) {
+    rowPass<Op>(src, rows, width);
+  } else {
+    src.copyTo(rows);
+  }
+  if (height > 1) {
+    Mat columns(src.size(), CV_8UC1);
+    columnPass<Op>(rows, columns, height);
+    rows = columns;
+  }
+  // Like cv::dilate, write into dst's memory if it has the right size,
+  // so views into a larger image get updated.
+  rows.copyTo(dst);
+}
+
+bool fastPath(const Mat& src) {
+  return src.type() == CV_8UC1 && !src.empty();
+}
+
+}  // namespace
+
+void dilateRect(const Mat& src, Mat& dst, Size size) {
+  if (!fastPath(src)) {
+    dilate(src, dst, getStructuringElement(MORPH_RECT, size), Point(-1, -1));
+    return;
+  }
+  rectOp<MaxOp>(src, dst, size);
+}
+
+void erodeRect(const Mat& src, Mat& dst, Size size) {
+  if (!fastPath(src)) {
+    erode(src, dst, getStructuringElement(MORPH_RECT, size), Point(-1, -1));
+    return;
+  }
+  rectOp<MinOp>(src, dst, size);
+}
+
+void closeRect(const Mat& src, Mat& dst, Size size) {
+  dilateRect(src, dst, size);
+  erodeRect(dst, dst, size);
+}
+
+void openRect(const Mat& src, Mat& dst, Size size) {
+  erodeRect(src, dst, size);
+  dilateRect(dst, dst, size);
+}
+
+Mat removeHorizontalLines(const Mat& gray, Size size) {
+  Mat closed;
+  closeRect(gray, closed, size);
+  return gray + ~closed;
+}
+
+}  // namespace musicocr
@@ -0,0 +1,98 @@
+#include "quality.hpp"
+
+#include <algorithm>
+
+#include "morphology.hpp"
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+const char* QualityReport::reason() const {
+  switch (problem) {
+    case UNDEREXPOSED: return "underexposed";
+    case OVEREXPOSED: return "overexposed";
+    case LOW_CONTRAST: return "low contrast";
+    case BLURRY: return "blurry";
+    case NOT_RULED: return "no staff lines";
+    default: return "ok";
+  }
+}
+
+double QualityGate::rowRuledScore(const Mat& thumbnail) const {
+  // Black-hat with a short vertical kernel: thin dark horizontal strokes.
+  Mat closed;
+  closeRect(thumbnail, closed, Size(1, 5));
+  const Mat strokes = (closed - thumbnail) >= config.rulingInk;
+  // Of those, only the long ones.
+  Mat lines;
+  openRect(strokes, lines, Size(std::max(1, thumbnail.cols / 16), 1));
+  return (double)countNonZero(lines) / thumbnail.total();
+}
+
+double QualityGate::ruledScore(const Mat& thumbnail) const {
+  Mat transposed;
+  transpose(thumbnail, transposed);
+  return std::max(rowRuledScore(thumbnail), rowRuledScore(transposed));
+}
+
+QualityReport QualityGate::check(const Mat& grey) const {
+  CV_Assert(grey.type() == CV_8UC1 && !grey.empty());
+  QualityReport report;
+  const int64 start = getTickCount();
+
+  // Only ever reduce: blowing a small image up would make it look blurry.
+  Mat thumbnail = grey;
+  if (grey.cols > config.thumbnailWidth) {
+    const int rows = std::max(1, cvRound((double)grey.rows
+                                         * config.thumbnailWidth / grey.cols));
+    resize(grey, thumbnail, Size(config.thumbnailWidth, rows), 0, 0,
+           INTER_AREA);
+  }
+
+  int histogram[256] = {0};
+  for (int y = 0; y < thumbnail.rows; y++) {
+    const uchar* row = thumbnail.ptr<uchar>(y);
+    for (int x = 0; x < thumbnail.cols; x++) histogram[row[x]]++;
+  }
+  const double total = (double)thumbnail.total();
+  double sum = 0.0;
+  int low = -1, high = -1, seen = 0;
+  for (int v = 0; v < 256; v++) {
+    sum += (double)v * histogram[v];
+    seen += histogram[v];
+    if (low < 0 && seen >= 0.05 * total) low = v;
+    if (high < 0 && seen >= 0.95 * total) high = v;
+  }
+  report.brightness = sum / total;
+  report.clipped = (histogram[0] + histogram[255]) / total;
+  report.contrast = high - low;
+
+  Scalar mean, deviation, laplacianMean, laplacianDeviation;
+  meanStdDev(thumbnail, mean, deviation);
+  Mat laplacian;
+  Laplacian(thumbnail, laplacian, CV_16S);
+  meanStdDev(laplacian, laplacianMean, laplacianDeviation);
+  report.sharpness =
+      deviation[0] > 0.0 ? laplacianDeviation[0] / deviation[0] : 0.0;
+
+  report.ruledScore = ruledScore(thumbnail);
+
+  if (report.brightness < config.minBrightness) {
+    report.problem = QualityReport::UNDEREXPOSED;
+  } else if (report.brightness > config.maxBrightness
+             || report.clipped > config.maxClipped) {
+    report.problem = QualityReport::OVEREXPOSED;
+  } else if (report.contrast < config.minContrast) {
+    report.problem = QualityReport::LOW_CONTRAST;
+  } else if (report.sharpness < config.minSharpness) {
+    report.problem = QualityReport::BLURRY;
+  } else if (report.ruledScore < config.minRuledScore) {
+    report.problem = QualityReport::NOT_RULED;
+  }
+  report.milliseconds = (getTickCount() - start) * 1000.0 / getTickFrequency();
+  return report;
+}
+
+}  // namespace musicocr
@@ -0,0 +1,65 @@
+#include "regionstats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// Sum over r from an integral image.
+template<typename T>
+T rectSum(const Mat& integral, const Rect& r) {
+  return integral.at<T>(r.y + r.height, r.x + r.width)
+       - integral.at<T>(r.y, r.x + r.width)
+       - integral.at<T>(r.y + r.height, r.x)
+       + integral.at<T>(r.y, r.x);
+}
+
+}  // namespace
+
+RegionStats::RegionStats(const Mat& grey, const Mat& inkImage) {
+  CV_Assert(grey.type() == CV_8UC1);
+  integral(grey, sum, squares, CV_32S, CV_64F);
+  if (!inkImage.empty()) {
+    CV_Assert(inkImage.size() == grey.size());
+    Mat ones;
+    threshold(inkImage, ones, 0, 1, THRESH_BINARY);
+    integral(ones, ink, CV_32S);
+  }
+}
+
+Rect RegionStats::clip(const Rect& rect) const {
+  return rect & Rect(Point(0, 0), size());
+}
+
+int RegionStats::inkCount(const Rect& rect) const {
+  const Rect r = clip(rect);
+  if (ink.empty() || r.area() == 0) return 0;
+  return rectSum<int>(ink, r);
+}
+
+double RegionStats::inkDensity(const Rect& rect) const {
+  const Rect r = clip(rect);
+  if (r.area() == 0) return 0.0;
+  return (double)inkCount(r) / r.area();
+}
+
+double RegionStats::mean(const Rect& rect) const {
+  const Rect r = clip(rect);
+  if (empty() || r.area() == 0) return 0.0;
+  return (double)rectSum<int>(sum, r) / r.area();
+}
+
+double RegionStats::stddev(const Rect& rect) const {
+  const Rect r = clip(rect);
+  if (empty() || r.area() == 0) return 0.0;
+  const double m = mean(r);
+  const double variance = rectSum<double>(squares, r) / r.area() - m * m;
+  return std::sqrt(std::max(0.0, variance));
+}
+
+}  // namespace musicocr
@@ -0,0 +1,154 @@
+#include "runlength.hpp"
+
+#include <algorithm>
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// Append r to the row that starts at runs[first], merging it with the
+// last run if they overlap or touch. Runs have to come in order of their
+// start.
+void appendMerged(vector<PixelRun>& runs, size_t first, const PixelRun& r) {
+  if (runs.size() > first && r.start <= runs.back().end + 1) {
+    runs.back().end = std::max(runs.back().end, r.end);
+  } else {
+    runs.push_back(r);
+  }
+}
+
+}  // namespace
+
+RunLengthImage::RunLengthImage(int rows, int cols)
+  : rows(rows), cols(cols), rowStarts(rows + 1, 0) {}
+
+RunLengthImage::RunLengthImage(const Mat& binary)
+  : rows(binary.rows), cols(binary.cols) {
+  CV_Assert(binary.type() == CV_8UC1);
+  rowStarts.reserve(rows + 1);
+  for (int y = 0; y < rows; y++) {
+    const uchar* row = binary.ptr<uchar>(y);
+    int x = 0;
+    while (x < cols) {
+      while (x < cols && !row[x]) x++;
+      if (x == cols) break;
+      const int start = x;
+      while (x < cols && row[x]) x++;
+      addRun(start, x - 1);
+    }
+    endRow();
+  }
+}
+
+Mat RunLengthImage::toMat() const {
+  Mat binary = Mat::zeros(rows, cols, CV_8UC1);
+  for (int y = 0; y < rows; y++) {
+    uchar* row = binary.ptr<uchar>(y);
+    for (const PixelRun* r = rowBegin(y); r != rowEnd(y); r++) {
+      std::fill(row + r->start, row + r->end + 1, 255);
+    }
+  }
+  return binary;
+}
+
+RunLengthImage RunLengthImage::dilateHorizontal(int width) const {
+  // A pixel is set if the window [x - anchor, x - anchor + width - 1]
+  // touches a run.
+  const int anchor = std::max(1, width) / 2;
+  const int right = std::max(1, width) - 1 - anchor;
+  RunLengthImage result;
+  result.rows = rows;
+  result.cols = cols;
+  result.runs.reserve(runs.size());
+  for (int y = 0; y < rows; y++) {
+    const size_t first = result.runs.size();
+    for (const PixelRun* r = rowBegin(y); r != rowEnd(y); r++) {
+      appendMerged(result.runs, first,
+                   {std::max(0, r->start - right),
+                    std::min(cols - 1, r->end + anchor)});
+    }
+    result.endRow();
+  }
+  return result;
+}
+
+RunLengthImage RunLengthImage::erodeHorizontal(int width) const {
+  // A pixel stays set if the window around it is all foreground, where
+  // pixels outside the image count as foreground.
+  const int anchor = std::max(1, width) / 2;
+  const int right = std::max(1, width) - 1 - anchor;
+  RunLengthImage result;
+  result.rows = rows;
+  result.cols = cols;
+  result.runs.reserve(runs.size());
+  for (int y = 0; y < rows; y++) {
+    for (const PixelRun* r = rowBegin(y); r != rowEnd(y); r++) {
+      const int start = r->start == 0 ? 0 : r->start + anchor;
+      const int end = r->end == cols - 1 ? cols - 1 : r->end - right;
+      if (start <= end) result.addRun(start, end);
+    }
+    result.endRow();
+  }
+  return result;
+}
+
+RunLengthImage RunLengthImage::closeHorizontal(int width) const {
+  return dilateHorizontal(width).erodeHorizontal(width);
+}
+
+RunLengthImage RunLengthImage::dilateVertical(int height) const {
+  // Row y is the union of rows y - anchor .. y - anchor + height - 1.
+  const int anchor = std::max(1, height) / 2;
+  const int below = std::max(1, height) - 1 - anchor;
+  RunLengthImage result;
+  result.rows = rows;
+  result.cols = cols;
+  vector<PixelRun> window;
+  for (int y = 0; y < rows; y++) {
+    window.clear();
+    const int from = std::max(0, y - anchor);
+    const int to = std::min(rows - 1, y + below);
+    for (int source = from; source <= to; source++) {
+      window.insert(window.end(), rowBegin(source), rowEnd(source));
+    }
+    std::sort(window.begin(), window.end(),
+              [](const PixelRun& a, const PixelRun& b) {
+                return a.start < b.start;
+              });
+    const size_t first = result.runs.size();
+    for (const auto& r : window) appendMerged(result.runs, first, r);
+    result.endRow();
+  }
+  return result;
+}
+
+vector<int> RunLengthImage::rowProjection() const {
+  vector<int> counts(rows, 0);
+  for (int y = 0; y < rows; y++) {
+    for (const PixelRun* r = rowBegin(y); r != rowEnd(y); r++) {
+      counts[y] += r->end - r->start + 1;
+    }
+  }
+  return counts;
+}
+
+vector<int> RunLengthImage::columnProjection() const {
+  // Count where runs start and end, then add up from left to right.
+  vector<int> changes(cols + 1, 0);
+  for (const auto& r : runs) {
+    changes[r.start]++;
+    changes[r.end + 1]--;
+  }
+  vector<int> counts(cols);
+  int count = 0;
+  for (int x = 0; x < cols; x++) {
+    count += changes[x];
+    counts[x] = count;
+  }
+  return counts;
+}
+
+}  // namespace musicocr
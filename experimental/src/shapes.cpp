@@ -1,6 +1,8 @@
 #include "shapes.hpp"
+#include "morphology.hpp"
 #include "training.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <iostream>
 #include <opencv2/highgui.hpp>
 
@@ -8,65 +10,205 @@ namespace musicocr {
 
 const std::vector<cv::Rect>& ShapeFinder::getContourBoxes(const Mat& focused) {
   if (contourBoxes.size() > 0) { return contourBoxes; }
-  Mat processed;
-  focused.copyTo(processed);
-  // erode, dilate horizontally to get just the horizontal lines.
-  const int edHorizontalWidth = processed.cols / config.horizontalSizeFudge;
+  const int edHorizontalWidth = focused.cols / config.horizontalSizeFudge;
+  return findContourBoxes(removeHorizontalLines(focused,
+      Size(edHorizontalWidth, config.horizontalHeight)));
+}
 
-  // Could just create this once when config gets read.
-  Mat horizontalStructure = getStructuringElement(MORPH_RECT,
-    Size(edHorizontalWidth, config.horizontalHeight));
+const std::vector<cv::Rect>& ShapeFinder::getContourBoxes(
+    const SheetLine& sheetLine) {
+  if (contourBoxes.size() > 0) { return contourBoxes; }
+  if (pageShapes != nullptr && pageShapes->covers(pageLine)) {
+    // The page's boxes are sorted left to right already, and cutting
+    // them to the viewport keeps them that way.
+    const Rect& bb = sheetLine.getBoundingBox();
+    const vector<int>& pageIndices = pageShapes->getLineShapes(pageLine);
+    map<int, int> position;
+    for (size_t i = 0; i < pageIndices.size(); i++) {
+      position.emplace(pageIndices[i], i);
+    }
+    componentStats.clear();
+    for (size_t i = 0; i < pageIndices.size(); i++) {
+      const Rect& box = pageShapes->getBox(pageIndices[i]);
+      contourBoxes.push_back((box & bb) - bb.tl());
+      // The nearest enclosing shape that is on this line as well.
+      int parent = pageShapes->getParent(pageIndices[i]);
+      while (parent >= 0 && position.find(parent) == position.end()) {
+        parent = pageShapes->getParent(parent);
+      }
+      boxParents.push_back(parent >= 0 ? position[parent] : -1);
+    }
+    return contourBoxes;
+  }
+  if (!sheetLine.getStaffFreeInk().empty()) {
+    return segmentInk(sheetLine.getStaffFreeInk());
+  }
+  return findContourBoxes(sheetLine.getStaffFreeViewPort());
+}
 
-  dilate(processed, processed, horizontalStructure, Point(-1, -1));
-  erode(processed, processed, horizontalStructure, Point(-1, -1));
+const std::vector<cv::Rect>& ShapeFinder::getContourBoxes(const Sheet& sheet) {
+  if (contourBoxes.size() > 0) { return contourBoxes; }
+  if (!sheet.getStaffFreeInkPage().empty()) {
+    return segmentInk(sheet.getStaffFreeInkPage());
+  }
+  // Each line's band of the page gets the threshold that its viewport
+  // gets on its own. Where two viewports overlap, the band boundary is
+  // halfway between them. Outside all viewports there is nothing.
+  const Mat& staffFree = sheet.getStaffFreePage();
+  Mat processed = Mat::zeros(staffFree.size(), CV_8UC1);
+  const int fixedType = config.thresholdType & ~(THRESH_OTSU | THRESH_TRIANGLE);
+  for (size_t l = 0; l < sheet.getLineCount(); l++) {
+    const Rect& bb = sheet.getNthLine(l).getBoundingBox();
+    int top = bb.y;
+    int bottom = bb.br().y;
+    for (size_t m = 0; m < sheet.getLineCount(); m++) {
+      const Rect& other = sheet.getNthLine(m).getBoundingBox();
+      if (m == l || (other & bb).area() == 0) continue;
+      if (other.y < bb.y || (other.y == bb.y && m < l)) {
+        top = std::max(top, (bb.y + other.br().y) / 2);
+      } else {
+        bottom = std::min(bottom, (other.y + bb.br().y) / 2);
+      }
+    }
+    if (bottom <= top) continue;
+    Mat unused;
+    const double lineThreshold = threshold(staffFree(bb), unused,
+        config.thresholdValue, 255, config.thresholdType);
+    const Rect band(bb.x, top, bb.width, bottom - top);
+    Mat target = processed(band);
+    threshold(staffFree(band), target, lineThreshold, 255, fixedType);
+  }
+  return segmentInk(processed);
+}
 
-  // Now 'subtract' the horizontal lines from 'focused'.
-  processed = focused + ~processed;
+const std::vector<cv::Rect>& ShapeFinder::findContourBoxes(
+    const Mat& staffFree) {
+  Mat processed;
   // threshold, blur, canny
-  threshold(processed, processed, config.thresholdValue, 255, config.thresholdType);
-  Mat tmp = Mat::zeros(processed.rows, processed.cols, processed.type());
-  GaussianBlur(processed, tmp, Size(config.gaussianKernel, config.gaussianKernel),
+  threshold(staffFree, processed, config.thresholdValue, 255, config.thresholdType);
+  return segmentInk(processed);
+}
+
+const std::vector<cv::Rect>& ShapeFinder::segmentInk(const Mat& ink) {
+  Mat processed;
+  GaussianBlur(ink, processed, Size(config.gaussianKernel, config.gaussianKernel),
                0, 0);
-  tmp.copyTo(processed);
-
-  vector<vector<Point>> contours;
-  vector<Vec4i> hierarchy;
-  findContours(processed, contours, hierarchy, RETR_TREE,
-               CHAIN_APPROX_SIMPLE, Point(0, 0));
-
-  contourBoxes.resize(contours.size());
-  vector<vector<Point>> hull(contours.size());
-  for (int i = 0; i < contours.size(); i++) {
-    //drawContours(cont, contours, i, Scalar(255, 0, 0), 1, 8,
-    //  hierarchy, 0, Point(0, 0));
-    convexHull(Mat(contours[i]), hull[i], false);
-    contourBoxes[i] = boundingRect(Mat(hull[i]));
-  }
-  std::sort(contourBoxes.begin(), contourBoxes.end(), musicocr::rectLeft);
+
+  // Boxes in the order the segmentation found them, and the index of
+  // each box's enclosing box (-1 if there is none).
+  vector<Rect> boxes;
+  vector<int> parents;
+  if (config.segmentation == ContourConfig::COMPONENTS) {
+    // Same boxes as the contours below, plus statistics.
+    componentStats = findComponents(processed, true);
+    for (const auto& cs : componentStats) {
+      boxes.push_back(cs.box);
+      parents.push_back(cs.parent);
+    }
+  } else {
+    vector<vector<Point>> contours;
+    vector<Vec4i> hierarchy;
+    findContours(processed, contours, hierarchy, RETR_TREE,
+                 CHAIN_APPROX_SIMPLE, Point(0, 0));
+
+    boxes.resize(contours.size());
+    vector<vector<Point>> hull(contours.size());
+    for (int i = 0; i < contours.size(); i++) {
+      //drawContours(cont, contours, i, Scalar(255, 0, 0), 1, 8,
+      //  hierarchy, 0, Point(0, 0));
+      convexHull(Mat(contours[i]), hull[i], false);
+      boxes[i] = boundingRect(Mat(hull[i]));
+      parents.push_back(hierarchy[i][3]);
+    }
+  }
+
+  // Sort left to right, and keep the parent indices pointing at the
+  // right boxes. A box can start at the same x as the box around it (a
+  // hole's box is the box of the border around it), so ties go to the
+  // less deeply nested box: parents always come before their children.
+  vector<int> depth(boxes.size(), 0);
+  for (size_t i = 0; i < boxes.size(); i++) {
+    for (int p = parents[i]; p >= 0; p = parents[p]) depth[i]++;
+  }
+  vector<int> order(boxes.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&boxes, &depth](int a, int b) {
+    if (boxes[a].x != boxes[b].x) {
+      return musicocr::rectLeft(boxes[a], boxes[b]);
+    }
+    if (depth[a] != depth[b]) return depth[a] < depth[b];
+    return a < b;
+  });
+  vector<int> position(order.size());
+  for (size_t i = 0; i < order.size(); i++) position[order[i]] = i;
+  contourBoxes.resize(order.size());
+  boxParents.resize(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    contourBoxes[i] = boxes[order[i]];
+    const int parent = parents[order[i]];
+    boxParents[i] = parent >= 0 ? position[parent] : -1;
+  }
+  if (!componentStats.empty()) {
+    vector<ComponentStats> sorted(componentStats.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      sorted[i] = componentStats[order[i]];
+      sorted[i].parent = boxParents[i];
+    }
+    componentStats.swap(sorted);
+  }
   return contourBoxes;
 }
 
 void ShapeFinder::firstPass(const std::vector<cv::Rect>& rectangles,
                             const cv::Mat& viewPort,
+                            const cv::Mat& samplePort,
                             const cv::Ptr<cv::ml::StatModel>& statModel,
                             const cv::Ptr<cv::ml::StatModel>& fineStatModel) {
-  SampleData sd;
+  // The samples are made from each shape's crop the same way TrainKnn
+  // makes them from the saved crops: the fine model's with the
+  // horizontal lines removed, from the crop itself or, with
+  // staffFreeSamples, already from the page, and bit features from the
+  // crop's own threshold.
+  SampleData sd, fineSd;
+  fineSd.setPreprocessing(true);
+  fineSd.setStaffFree(config.staffFreeSamples);
+  if (statModel && statModel->isTrained()) {
+    sd.setFeatureType(SampleData::featureTypeOf(*statModel));
+  }
+  if (fineStatModel && fineStatModel->isTrained()) {
+    fineSd.setFeatureType(SampleData::featureTypeOf(*fineStatModel));
+  }
   TrainingKey key;
-  for (const auto& rect : rectangles) {
-    Mat partial = Mat(viewPort, rect);
-    // what does the system think this is.
-    cv::Mat sample = sd.makeSampleMatrix(partial, rect.tl().x, rect.tl().y);
-    float prediction = statModel->predict(sample);
-    const TrainingKey::TopLevelCategory cat =
-        static_cast<TrainingKey::TopLevelCategory>((int)prediction);
-    Shape *shape = new Shape(rect);
-    shape->setTopLevelCategory(cat);
-    if (fineStatModel && fineStatModel->isTrained()) {
-      float prediction2 = fineStatModel->predict(sample);
-      const TrainingKey::Category cat2 =
-          static_cast<TrainingKey::Category>((int)prediction2);
-      shape->setCategory(cat2);
-    } 
+  vector<ShapeCluster> clusters;
+  // If the rectangles came with their nesting, containment is read off
+  // the hierarchy instead of being tested pairwise.
+  const bool nested = boxParents.size() == rectangles.size();
+  vector<Shape*> byIndex;
+  for (size_t i = 0; i < rectangles.size(); i++) {
+    const Rect& rect = rectangles[i];
+    Shape *shape = new Shape(rect, staffMetrics.scaled(2));
+    byIndex.push_back(shape);
+    statistics.shapes++;
+    if (config.preClassify && preClassify(shape)) {
+      statistics.preClassified++;
+    } else {
+      if (config.clusterShapes) {
+        classifyByCluster(shape, Mat(viewPort, rect), Mat(samplePort, rect),
+                          sd, fineSd, statModel, fineStatModel, clusters);
+      } else {
+        classify(shape, Mat(samplePort, rect), sd, fineSd, statModel,
+                 fineStatModel);
+      }
+    }
+    // Everything enclosing this shape comes earlier in left-to-right
+    // order, so it is already known.
+    vector<Shape*> ancestors;
+    if (nested) {
+      for (int p = boxParents[i]; p >= 0; p = boxParents[p]) {
+        ancestors.push_back(byIndex[p]);
+        byIndex[p]->addContainedShape(shape);
+      }
+    }
     // Go over known shapes and add this one to their neighbour lists.
     // There is nothing there yet to the right of this rectangle, so only
     // need to look at whether things' left or right edge is near this
@@ -74,7 +216,12 @@ void ShapeFinder::firstPass(const std::vector<cv::Rect>& rectangles,
     for (auto& coordshapes : shapes) {
       vector<unique_ptr<Shape>>& theseshapes = coordshapes.second;
       for (auto& s : theseshapes) {
-        s->maybeAddNeighbour(shape);
+        if (!nested) {
+          s->maybeAddNeighbour(shape);
+        } else if (std::find(ancestors.begin(), ancestors.end(), s.get())
+                   == ancestors.end()) {
+          s->maybeAddNeighbour(shape, false);
+        }
       }
     }
     // Insert into shapes map at tl corner horizontal coordinate.
@@ -90,6 +237,134 @@ void ShapeFinder::firstPass(const std::vector<cv::Rect>& rectangles,
   }
 }
 
+bool ShapeFinder::preClassify(Shape* shape) const {
+  const Rect& r = shape->getRectangle();
+  if (r.width <= maxSpeckSize && r.height <= maxSpeckSize) {
+    shape->setTopLevelCategory(TrainingKey::TopLevelCategory::round);
+    shape->setCategory(TrainingKey::Category::speck);
+    return true;
+  }
+  if (r.height <= maxConnectorHeight &&
+      (float)r.width / r.height >= config.minConnectorAspect) {
+    shape->setTopLevelCategory(TrainingKey::TopLevelCategory::hline);
+    shape->setCategory(TrainingKey::Category::connector);
+    return true;
+  }
+  // Same ratio as in isPotentialBarLine.
+  if (r.width <= maxVerticalWidth &&
+      (float)r.height / r.width >= config.minVerticalAspect) {
+    shape->setTopLevelCategory(TrainingKey::TopLevelCategory::vline);
+    shape->setCategory(TrainingKey::Category::vertical);
+    return true;
+  }
+  return false;
+}
+
+void ShapeFinder::classify(Shape* shape, const cv::Mat& partial,
+                           const SampleData& sd, const SampleData& fineSd,
+                           const cv::Ptr<cv::ml::StatModel>& statModel,
+                           const cv::Ptr<cv::ml::StatModel>& fineStatModel) {
+  const Rect& rect = shape->getRectangle();
+  // what does the system think this is.
+  cv::Mat sample = sd.makeSampleMatrix(partial, rect.tl().x, rect.tl().y);
+  float confidence = 1.0;
+  float prediction = predictWithConfidence(statModel, sample, &confidence);
+  statistics.coarseInferences++;
+  const TrainingKey::TopLevelCategory cat =
+      static_cast<TrainingKey::TopLevelCategory>((int)prediction);
+  shape->setTopLevelCategory(cat);
+  if (fineStatModel && fineStatModel->isTrained()) {
+    TrainingKey::Category cat2 = TrainingKey::Category::undefined;
+    if (needsFineModel(cat, confidence, rect, &cat2)) {
+      // The fine model is trained on preprocessed samples.
+      const cv::Mat fineSample =
+          fineSd.makeSampleMatrix(partial, rect.tl().x, rect.tl().y);
+      float prediction2 = fineStatModel->predict(fineSample);
+      cat2 = static_cast<TrainingKey::Category>((int)prediction2);
+      statistics.fineInferences++;
+    } else {
+      statistics.fineSkipped++;
+    }
+    shape->setCategory(cat2);
+  } 
+}
+
+void ShapeFinder::classifyByCluster(Shape* shape, const cv::Mat& partial,
+    const cv::Mat& sampleCrop, const SampleData& sd, const SampleData& fineSd,
+    const cv::Ptr<cv::ml::StatModel>& statModel,
+    const cv::Ptr<cv::ml::StatModel>& fineStatModel,
+    vector<ShapeCluster>& clusters) {
+  statistics.clusteredShapes++;
+  const ShapeDescriptor descriptor(shape->getRectangle(), partial);
+  ShapeCluster* best = nullptr;
+  float bestDistance = config.clusterDistance;
+  const int positionTolerance =
+      staffMetrics.scaled(config.clusterPositionTolerance);
+  for (auto& cluster : clusters) {
+    const float d = cluster.representative.distance(
+        descriptor, config.clusterSizeTolerance, positionTolerance);
+    if (d <= bestDistance) {
+      best = &cluster;
+      bestDistance = d;
+    }
+  }
+  if (best != nullptr) {
+    shape->setTopLevelCategory(best->topLevelCategory);
+    shape->setCategory(best->category);
+    return;
+  }
+  classify(shape, sampleCrop, sd, fineSd, statModel, fineStatModel);
+  clusters.push_back({descriptor, shape->getTopLevelCategory(),
+                      shape->getCategory()});
+  statistics.clusters++;
+}
+
+float ShapeFinder::predictWithConfidence(
+    const cv::Ptr<cv::ml::StatModel>& statModel,
+    const cv::Mat& sample, float* confidence) {
+  cv::Ptr<cv::ml::KNearest> knn = statModel.dynamicCast<cv::ml::KNearest>();
+  if (!knn) {
+    *confidence = 1.0;
+    return statModel->predict(sample);
+  }
+  // Confidence is the share of the neighbours that agree with the vote.
+  const int k = knn->getDefaultK();
+  Mat results, neighbours;
+  const float prediction = knn->findNearest(sample, k, results, neighbours);
+  int agreeing = 0;
+  for (int i = 0; i < neighbours.cols; i++) {
+    if ((int)neighbours.at<float>(0, i) == (int)prediction) agreeing++;
+  }
+  *confidence = neighbours.cols > 0 ? (float)agreeing / neighbours.cols : 0.0;
+  return prediction;
+}
+
+bool ShapeFinder::needsFineModel(TrainingKey::TopLevelCategory cat,
+                                 float confidence,
+                                 const cv::Rect& rect,
+                                 TrainingKey::Category* category) const {
+  if (confidence < config.fineModelConfidence) return true;
+  switch(cat) {
+    // Connector pieces are the only fine category that maps to hline.
+    case TrainingKey::TopLevelCategory::hline:
+      *category = TrainingKey::Category::connector;
+      return false;
+    // Bar lines and other vertical lines get told apart later on.
+    case TrainingKey::TopLevelCategory::vline:
+      *category = TrainingKey::Category::vertical;
+      return false;
+    // Note heads and dots matter, specks don't.
+    case TrainingKey::TopLevelCategory::round:
+      if (rect.area() <= config.maxSpeckArea) {
+        *category = TrainingKey::Category::speck;
+        return false;
+      }
+      return true;
+    default:
+      return true;
+  }
+}
+
 bool ShapeFinder::isPotentialBarLine(const Shape& s) const {
   const auto fcat = s.getCategory();
   if (fcat == TrainingKey::Category::vertical) {
@@ -110,16 +385,20 @@ bool ShapeFinder::isPotentialBarLine(const Shape& s) const {
       return true;
     }
   }
+  return false;
 }
 
 void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
                                   const cv::Rect& relativeInnerBox,
-                                  const std::pair<int, int>& slCoords) {
-  const int slHeight = slCoords.second - slCoords.first;
+                                  const SheetLine& sheetLine) {
+  const std::pair<int, int> tb = sheetLine.getCoordinates();
+  const int slHeight = tb.second - tb.first;
   const int leftEdge = relativeInnerBox.tl().x;
   const int rightEdge = relativeInnerBox.br().x;
   const int topEdge = relativeInnerBox.tl().y;
   const int bottomEdge = relativeInnerBox.br().y;
+  const int minBarDistance = staffMetrics.scaled(40);
+  const int endTolerance = staffMetrics.scaled(5);
 
   // First, look for voice connectors (long bar lines).
   map<int, int> positions;
@@ -134,7 +413,7 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
       bool aboveTop = r.tl().y < topEdge;
       bool belowBottom = r.br().y > bottomEdge;
       int position = -1;
-      if (r.height > slHeight + 20) {
+      if (r.height > slHeight + staffMetrics.scaled(20)) {
         if (!aboveTop && belowBottom) { position = 1; }  // top voice
         else if (aboveTop && belowBottom) { position = 2; } // middle voice
         else if (aboveTop && !belowBottom) { position = 3; }  // bottom voice
@@ -200,7 +479,7 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
     for (size_t i = 0; i < list.size(); i++) {
       if (!isPotentialBarLine(*list[i])) { continue; }
 
-      if (previousBarline == -1 && xcoord < 20) {
+      if (previousBarline == -1 && xcoord < staffMetrics.scaled(20)) {
         // this is probably a bar line
         barLines.emplace(xcoord, list[i].get());
         previousBarline = xcoord;
@@ -210,7 +489,7 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
       if (xcoord == lastXCoord) {
         // this is probably a bar line, unless we've placed one
         // not too far left of this already.
-        if (xcoord - previousBarline >= 40) {
+        if (xcoord - previousBarline >= minBarDistance) {
           barLines.emplace(xcoord, list[i].get());
           previousBarline = xcoord;
         }
@@ -223,14 +502,20 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
 
       const int height = r.br().y - r.tl().y;
       // right height?
-      if (height < slHeight - 6) {
+      if (height < slHeight - staffMetrics.scaled(6)) {
         continue;
       }
       // are the ends near the upper/lower horizontal lines?
-      if (std::abs(r.tl().y - slCoords.first) > 5 ||
-          std::abs(r.br().y - slCoords.second) > 5) {
+      const std::pair<int, int> slCoords =
+          sheetLine.getCoordinatesAt(r.x + r.width / 2);
+      if (std::abs(r.tl().y - slCoords.first) > endTolerance ||
+          std::abs(r.br().y - slCoords.second) > endTolerance) {
         continue; 
       }
+      if (config.minBarLineInk > 0.0f &&
+          regionStats.inkDensity(r) < config.minBarLineInk) {
+        continue;
+      }
 
       const auto& neighbours = list[i]->getNeighbours();
       bool noteNeck = false;
@@ -252,15 +537,16 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
     }
   }
   // Thin out the bar lines. Assume the first bar line is correct
-  // and that bar lines are at least 40 and at most 150 px apart.
-  int previousBarX = barLines.cbegin()->first;
+  // and that bar lines are at least 40 and at most 150 px apart (on
+  // the 0.2 photos, see StaffMetrics).
+  int previousBarX = barLines.empty() ? -1 : barLines.cbegin()->first;
   int beforePrevious = -1;
   vector<int> droplist;
   for (auto& bl : barLines) {
     if (bl.first == previousBarX) continue;
     const int distance = bl.first - previousBarX;
     cout << "bar line distance: " << distance << endl; 
-    if (distance < 40) {
+    if (distance < minBarDistance) {
       // Should one of these be dropped?
       cout << "triplet: " << beforePrevious << ", " << previousBarX
            << ", " << bl.first << endl;
@@ -295,12 +581,30 @@ void ShapeFinder::scanForBarLines(const cv::Mat& viewPort,
 void ShapeFinder::initLineScan(const SheetLine& sheetLine,
                                const cv::Ptr<cv::ml::StatModel>& statModel,
                                const cv::Ptr<cv::ml::StatModel>& fineStatModel) {
-  Mat viewPort = sheetLine.getViewPort().clone();
-  const vector<Rect>& rectangles = getContourBoxes(viewPort); 
-  firstPass(rectangles, viewPort, statModel, fineStatModel);
-  const std::pair<int, int> tb = sheetLine.getCoordinates();
+  const Mat& viewPort = sheetLine.getViewPort();
+  staffMetrics = sheetLine.getStaffMetrics();
+  auto scaledLimit = [this](int pixels) {
+    return pixels > 0 ? staffMetrics.scaled(pixels) : 0;
+  };
+  maxSpeckSize = scaledLimit(config.maxSpeckSize);
+  maxConnectorHeight = scaledLimit(config.maxConnectorHeight);
+  maxVerticalWidth = scaledLimit(config.maxVerticalWidth);
+  // Only the bar line ink check uses the region statistics.
+  regionStats = RegionStats();
+  if (config.minBarLineInk > 0.0f) {
+    Mat ink = sheetLine.getInk();
+    if (ink.empty()) {
+      threshold(viewPort, ink, 0, 255, THRESH_BINARY_INV | THRESH_OTSU);
+    }
+    regionStats = RegionStats(viewPort, ink);
+  }
+  const vector<Rect>& rectangles = getContourBoxes(sheetLine);
+  firstPass(rectangles, viewPort,
+            config.staffFreeSamples ? sheetLine.getStaffFreeViewPort()
+                                    : viewPort,
+            statModel, fineStatModel);
   const Rect relative = sheetLine.getInnerBox() - sheetLine.getBoundingBox().tl();
-  scanForBarLines(viewPort, relative, tb);
+  scanForBarLines(viewPort, relative, sheetLine);
 }
 
 void ShapeFinder::scanForNotes(const Rect& relativeInnerBox) {
@@ -465,7 +769,8 @@ void ShapeFinder::scanLine(const SheetLine& sheetLine,
 
       rectangle(cont, list[i]->getRectangle(), Scalar(0, 0, 0), 2);
       imshow(processedWindowName, cont);
-      Mat partial = Mat(viewPort, list[i]->getRectangle());
+      Mat partial = Mat(sheetLine.getStaffFreeViewPort(),
+                        list[i]->getRectangle());
 
       Mat scaleup;
 
@@ -481,17 +786,10 @@ void ShapeFinder::scanLine(const SheetLine& sheetLine,
   }
 }
 
-Mat ShapeFinder::preprocess(const Mat& img) {
-  // Run horizontal dilate/erode and subtract to get rid of the 
-  // horizontal lines. Then use threshold.
-  // This might be useful for recognition/training in general?
-  Mat horizontalStructure = getStructuringElement(MORPH_RECT,
-    Size(10, 1));
+Mat ShapeFinder::preprocess(const Mat& staffFree) {
+  // The horizontal lines are already gone, so just threshold.
   Mat tmp;
-  dilate(img, tmp, horizontalStructure, Point(-1, -1));
-  erode(tmp, tmp, horizontalStructure, Point(-1, -1));
-  tmp = img + ~tmp;
-  threshold(tmp, tmp, config.thresholdValue, 255, config.thresholdType);
+  threshold(staffFree, tmp, config.thresholdValue, 255, config.thresholdType);
   tmp = ~tmp;
   return tmp;
 }
@@ -568,12 +866,27 @@ void ShapeFinder::getTrainingDataForLine(const Mat& focused,
   const string& questionWindowName,
   const string& filename,
   ofstream& responsesFile) {
+  // Remove the horizontal lines once for the whole line, and take
+  // both the boxes and the displayed crops from that.
+  const Mat staffFree = removeHorizontalLines(focused,
+      Size(focused.cols / config.horizontalSizeFudge, config.horizontalHeight));
+  getTrainingDataForLine(focused, staffFree, processedWindowName,
+                         questionWindowName, filename, responsesFile);
+}
+
+void ShapeFinder::getTrainingDataForLine(const Mat& focused,
+  const Mat& staffFree,
+  const string& processedWindowName,
+  const string& questionWindowName,
+  const string& filename,
+  ofstream& responsesFile) {
 
   // This is just for showing the contours.
   Mat cont;
   cvtColor(focused, cont, COLOR_GRAY2BGR);
 
-  vector<Rect> rectangles = getContourBoxes(focused); 
+  vector<Rect> rectangles = contourBoxes.empty()
+      ? findContourBoxes(staffFree) : contourBoxes;
 
   Mat partial, scaleup;
   char fname[200];
@@ -581,7 +894,8 @@ void ShapeFinder::getTrainingDataForLine(const Mat& focused,
     rectangle(cont, rectangles[i], Scalar(0, 0, 127), 2);
     imshow(processedWindowName, cont);
 
-    partial = Mat(focused, rectangles[i]);
+    partial = Mat(config.staffFreeSamples ? staffFree : focused,
+                  rectangles[i]);
 
     cout << "showing contour with area " << rectangles[i].area()
          << " at coordinates " << rectangles[i].tl()
@@ -592,12 +906,8 @@ void ShapeFinder::getTrainingDataForLine(const Mat& focused,
 
     // Scaling up more just makes the image too blurry.
     // resize(partial, scaleup, Size(), 2.0, 2.0, INTER_CUBIC);
-    Mat horizontalStructure = getStructuringElement(cv::MORPH_RECT, cv::Size(10, 1));
     Mat tmp;
-    dilate(partial, tmp, horizontalStructure, cv::Point(-1, -1));
-    erode(tmp, tmp, horizontalStructure, cv::Point(-1, -1));
-    tmp = partial + ~tmp;
-    threshold(tmp, tmp, 0.0f, 255, 12);
+    threshold(Mat(staffFree, rectangles[i]), tmp, 0.0f, 255, 12);
     tmp = ~tmp;
     resize(tmp, scaleup, Size(), 2.0, 2.0, INTER_CUBIC);
 
@@ -612,7 +922,8 @@ void ShapeFinder::getTrainingDataForLine(const Mat& focused,
     sprintf(fname, "%s.%d.%d.%d.png", filename.c_str(), i,
             rectangles[i].tl().x, rectangles[i].tl().y);
 
-    // Partial is an 8-bit grayscale image.
+    // Partial is an 8-bit grayscale image (staff-free with
+    // staffFreeSamples).
     if (imwrite(fname, partial)) {
       responsesFile << i << ": " << cat << endl;
     } else {
@@ -622,6 +933,30 @@ void ShapeFinder::getTrainingDataForLine(const Mat& focused,
   cout << "Done with this line." << endl;
 }
 
+ShapeDescriptor::ShapeDescriptor(const cv::Rect& rect, const cv::Mat& partial)
+  : width(rect.width), height(rect.height), top(rect.y) {
+  Mat small;
+  resize(partial, small, Size(downscaledSize, downscaledSize), 0, 0,
+         INTER_AREA);
+  // Stretch to the full range so lighting differences along the line
+  // don't keep similar shapes apart.
+  double minVal, maxVal;
+  minMaxLoc(small, &minVal, &maxVal);
+  const double range = std::max(1.0, maxVal - minVal);
+  small.convertTo(pixels, CV_32F, 1.0 / range, -minVal / range);
+}
+
+float ShapeDescriptor::distance(const ShapeDescriptor& other,
+                                int sizeTolerance,
+                                int positionTolerance) const {
+  if (std::abs(width - other.width) > sizeTolerance ||
+      std::abs(height - other.height) > sizeTolerance ||
+      std::abs(top - other.top) > positionTolerance) {
+    return 2.0;
+  }
+  return (float)(norm(pixels, other.pixels, NORM_L1) / pixels.total());
+}
+
 CompositeShape::CompositeShape(CompositeShape::CompositeType type,
                                Shape* shape) : type(type) {
   shapes.push_back(shape); 
@@ -633,7 +968,32 @@ void CompositeShape::addShape(Shape* shape) {
   boundingBox |= shape->getRectangle();
 }
 
-Shape::Shape(const cv::Rect& rect) {
+void ScanStatistics::add(const ScanStatistics& other) {
+  shapes += other.shapes;
+  preClassified += other.preClassified;
+  coarseInferences += other.coarseInferences;
+  fineInferences += other.fineInferences;
+  fineSkipped += other.fineSkipped;
+  clusteredShapes += other.clusteredShapes;
+  clusters += other.clusters;
+}
+
+void ScanStatistics::print(std::ostream& out) const {
+  out << shapes << " shapes, " << preClassified << " decided by geometry";
+  if (shapes > 0) {
+    out << " (" << (100 * preClassified / shapes) << "%)";
+  }
+  out << ", " << coarseInferences << " coarse and "
+      << fineInferences << " fine inferences, "
+      << fineSkipped << " fine inferences skipped";
+  if (clusteredShapes > 0) {
+    out << ", " << clusters << " clusters for " << clusteredShapes
+        << " shapes (ratio " << ((float)clusters / clusteredShapes) << ")";
+  }
+  out << "." << endl;
+}
+
+Shape::Shape(const cv::Rect& rect, int distance) : smallDistance(distance) {
   rectangle = rect;
 }
 
@@ -702,20 +1062,26 @@ void Shape::print() const {
   }
 }
 
-void Shape::maybeAddNeighbour(Shape *shape) {
+void Shape::addContainedShape(Shape *shape) {
+  shape->addNeighbour(Neighbourhood::AROUND, this);
+  this->addNeighbour(Neighbourhood::IN, shape);
+}
+
+void Shape::maybeAddNeighbour(Shape *shape, bool checkContainment) {
   // First check containment. Line scanning always finds the enclosing
   // shape before the contained shapes, so the check only goes one way.
   const Rect& shapeRect = shape->getRectangle();
 
+  // Nothing of shape is near this, so it can't be a neighbour.
+  if (shapeRect.tl().x - rectangle.br().x > smallDistance) { return; }
+
   // Containment
-  if (shapeRect.tl().x >= rectangle.tl().x &&
+  if (checkContainment &&
+      shapeRect.tl().x >= rectangle.tl().x &&
       shapeRect.tl().y >= rectangle.tl().y &&
       shapeRect.br().x <= rectangle.br().x &&
       shapeRect.br().y <= rectangle.br().y) {
-    // 'this' is around shape
-    shape->addNeighbour(Neighbourhood::AROUND, this);
-    // shape is inside 'this'
-    this->addNeighbour(Neighbourhood::IN, shape);
+    addContainedShape(shape);
     return; 
   } 
 
@@ -790,4 +1156,52 @@ void Shape::maybeAddNeighbour(Shape *shape) {
   // to stop scanning for performance reasons. 
 }
 
+void PageShapes::segment(const Sheet& sheet) {
+  ShapeFinder finder(config);
+  boxes = finder.getContourBoxes(sheet);
+  parents = finder.getBoxParents();
+  const size_t lines = sheet.getLineCount();
+  covered.assign(lines, false);
+  lineShapes.assign(lines, vector<int>());
+  lineCounts.assign(boxes.size(), 0);
+  for (size_t l = 0; l < lines; l++) {
+    const SheetLine& sl = sheet.getNthLine(l);
+    covered[l] = sl.isRealMusicLine() && sl.getRotationSlope() == 0.0f;
+  }
+  for (size_t i = 0; i < boxes.size(); i++) {
+    const Rect& r = boxes[i];
+    // How far the shape is above or below the staff of each music line
+    // whose viewport it is in. Rotated lines count here, so that their
+    // shapes don't end up on the line next to them.
+    vector<pair<int, size_t>> distances;
+    for (size_t l = 0; l < lines; l++) {
+      const SheetLine& sl = sheet.getNthLine(l);
+      const Rect& bb = sl.getBoundingBox();
+      if (!sl.isRealMusicLine() || (r & bb).area() == 0) continue;
+      const std::pair<int, int> tb =
+          sl.getCoordinatesAt(r.x + r.width / 2 - bb.x);
+      const int top = bb.y + tb.first;
+      const int bottom = bb.y + tb.second;
+      distances.emplace_back(
+          std::max(0, std::max(top - r.br().y, r.y - bottom)), l);
+    }
+    if (distances.empty()) continue;
+    const int nearest =
+        std::min_element(distances.begin(), distances.end())->first;
+    for (const auto& d : distances) {
+      if (!covered[d.second]) continue;
+      const StaffMetrics& metrics =
+          sheet.getNthLine(d.second).getStaffMetrics();
+      if (d.first > nearest + metrics.scaled(config.shareDistance)) continue;
+      lineShapes[d.second].push_back(i);
+      lineCounts[i]++;
+    }
+  }
+}
+
+int PageShapes::getSharedCount() const {
+  return std::count_if(lineCounts.begin(), lineCounts.end(),
+                       [](int count) { return count > 1; });
+}
+
 }  // namespace
@@ -0,0 +1,95 @@
+#include "staffmetrics.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "runlength.hpp"
+
+namespace musicocr {
+
+using namespace std;
+using namespace cv;
+
+namespace {
+
+// Staff lines on the 0.2 test photos, top to top (median over the pages).
+const double referenceLineDistance = 6.0;
+
+// Of the paper runs, at least this share must be within a pixel of the
+// most common length for that to be the staff space.
+const double minPeakShare = 0.4;
+
+// The most common length in histogram (indexed by length, from 1),
+// refined with its neighbours; share is the part of all runs within a
+// pixel of it.
+double histogramPeak(const vector<int>& histogram, double* share) {
+  const auto peak = std::max_element(histogram.begin() + 1, histogram.end());
+  const int mode = (int)(peak - histogram.begin());
+  const int low = std::max(1, mode - 1);
+  const int high = std::min((int)histogram.size() - 1, mode + 1);
+  double weighted = 0.0;
+  int near = 0, total = 0;
+  for (int length = 1; length < (int)histogram.size(); length++) {
+    total += histogram[length];
+    if (length >= low && length <= high) {
+      weighted += (double)length * histogram[length];
+      near += histogram[length];
+    }
+  }
+  if (share) *share = total > 0 ? (double)near / total : 0.0;
+  return near > 0 ? weighted / near : 0.0;
+}
+
+}  // namespace
+
+double StaffMetrics::scale() const {
+  return empty() ? 1.0 : lineDistance() / referenceLineDistance;
+}
+
+int StaffMetrics::scaled(int pixels) const {
+  return std::max(1, cvRound(pixels * scale()));
+}
+
+int StaffMetrics::scaledArea(int pixels) const {
+  return cvRound(pixels * scale() * scale());
+}
+
+StaffMetrics staffMetricsFromInk(const Mat& ink) {
+  StaffMetrics metrics;
+  if (ink.rows < 8) return metrics;
+  // The columns of ink are the rows of its transpose.
+  Mat transposed;
+  transpose(ink, transposed);
+  const RunLengthImage columns(transposed);
+  // Nothing on a staff is anywhere near this long.
+  const int maxRun = ink.rows / 4;
+  vector<int> inkRuns(maxRun + 1, 0), paperRuns(maxRun + 1, 0);
+  for (int x = 0; x < columns.getRows(); x++) {
+    const PixelRun* previous = nullptr;
+    for (const PixelRun* r = columns.rowBegin(x); r != columns.rowEnd(x);
+         r++) {
+      const int length = r->end - r->start + 1;
+      if (length <= maxRun) inkRuns[length]++;
+      if (previous) {
+        const int gap = r->start - previous->end - 1;
+        if (gap <= maxRun) paperRuns[gap]++;
+      }
+      previous = r;
+    }
+  }
+  double share;
+  const double space = histogramPeak(paperRuns, &share);
+  if (share < minPeakShare) return metrics;
+  metrics.staffSpace = space;
+  metrics.lineThickness = histogramPeak(inkRuns, nullptr);
+  return metrics;
+}
+
+StaffMetrics estimateStaffMetrics(const Mat& grey) {
+  Mat ink;
+  adaptiveThreshold(grey, ink, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV,
+                    31, 10);
+  return staffMetricsFromInk(ink);
+}
+
+}  // namespace musicocr
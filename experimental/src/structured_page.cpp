@@ -3,6 +3,9 @@
 #include <opencv2/highgui.hpp>
 #include <unordered_map>
 
+#include "binarize.hpp"
+#include "components.hpp"
+#include "morphology.hpp"
 #include "shapes.hpp"
 #include "structured_page.hpp"
 #include "utils.hpp"
@@ -14,12 +17,19 @@ using namespace cv;
 
 vector<cv::Rect> Sheet::find_lines_outlines(const Mat& processed) const {
   Mat tmp;
-  Mat horizontalStructure = getStructuringElement(MORPH_RECT,
-      Size(processed.cols/30, 1));
-  dilate(processed, tmp, horizontalStructure, Point(-1, -1));
-  erode(tmp, tmp, horizontalStructure, Point(-1, -1));
+  closeRect(processed, tmp, Size(processed.cols/30, 1));
   adaptiveThreshold(tmp, tmp, 255, ADAPTIVE_THRESH_GAUSSIAN_C,
                     THRESH_BINARY, 15, -2);
+  if (config.runLengthOutlines) {
+    // The blur below spreads each pixel by about 3 in every direction.
+    const RunLengthImage spread =
+        RunLengthImage(tmp).dilateHorizontal(7).dilateVertical(7);
+    vector<Rect> rectangles;
+    for (const auto& cs : findComponents(spread, true)) {
+      rectangles.push_back(cs.box);
+    }
+    return rectangles;
+  }
   GaussianBlur(tmp, tmp, Size(7, 7), 0, 0);
   vector<vector<Point>> contours;
   vector<Vec4i> hierarchy;
@@ -59,19 +69,44 @@ void Sheet::printSheetInfo() const {
   for (const auto& l : sheetLines) {
     cout << "inner box: " << l.getInnerBox() 
          << ": height " << l.getInnerBox().height
-         << ", width " << l.getInnerBox().width
-         << endl;
+         << ", width " << l.getInnerBox().width;
+    if (!l.hasRepeatingRows()) {
+      cout << ", rows don't repeat like a staff";
+    }
+    if (!l.isRealMusicLine()) cout << ", not a music line";
+    cout << endl;
   }
 }
 
 void Sheet::createSheetLines(const vector<Rect>& outlines, const Mat& focused) {
+  if (config.scaleToStaff) {
+    staffMetrics = estimateStaffMetrics(focused);
+  }
+  // A fraction of the page width, or with staff metrics, that fraction
+  // of the pages it was tuned on, scaled to this page's staves.
+  const Size staffKernel(
+      staffMetrics.empty()
+          ? focused.cols / config.horizontalSizeFudge
+          : staffMetrics.scaled(StaffMetrics::referencePageWidth /
+                                config.horizontalSizeFudge),
+      1);
+  // The sheet lines are regions of this, so they don't need copies of
+  // their own unless they rotate.
+  page = focused.clone();
+  staffFreePage = removeHorizontalLines(focused, staffKernel);
+  if (config.binarization == SheetConfig::SAUVOLA) {
+    inkPage = sauvolaInk(focused, config.sauvolaWindow, config.sauvolaK);
+    staffFreeInkPage = removeHorizontalInk(inkPage, staffKernel.width);
+  }
   vector<Rect> horizontal;
   for (const auto& r : outlines) {
     const int area = r.area();
     // experimentally determined values. These work ok for A4
     // paper with what I'd consider "standard" lining.
-    if (area < 20000 || area > 80000
-        || r.height < 38 || r.width < 500 || r.height > r.width) {
+    if (area < staffMetrics.scaledArea(20000)
+        || area > staffMetrics.scaledArea(80000)
+        || r.height < staffMetrics.scaled(38)
+        || r.width < staffMetrics.scaled(500) || r.height > r.width) {
       // Skip this, it's most likely not a sheet line.
       continue;
     }
@@ -79,39 +114,59 @@ void Sheet::createSheetLines(const vector<Rect>& outlines, const Mat& focused) {
   }
   std::sort(horizontal.begin(), horizontal.end(), musicocr::rectTop);
   for (const auto& h : horizontal) {
-    sheetLines.emplace_back(h, focused);
+    sheetLines.emplace_back(h, page, staffFreePage, staffKernel,
+                            staffMetrics);
+    if (!source.empty()) {
+      sheetLines.back().setSource(source, sourceTransform);
+    }
+    if (!inkPage.empty()) {
+      sheetLines.back().setInk(inkPage, staffFreeInkPage);
+    }
   }
   int idx = 0;
   for (auto& sl : sheetLines) {
     cout << "line " << idx << endl;
     idx++;
-    vector<Vec4i> lines = sl.obtainGridlines();
-    sl.accumulateHorizontalLines(lines);
+    if (config.periodicityCheck && !sl.hasPeriodicRows(config)) continue;
+    sl.findHorizontalLines(config);
     // xxx not sure if this is pulling its weight.
     const float slope = sl.getSlope();
     cout << "slope: " << slope << endl;
-    if (std::abs(slope) >= 0.025) {
+    if (config.deskew == SheetConfig::SHEAR) {
+      sl.fitShear(config);
+    } else if (std::abs(slope) >= 0.025) {
       cout << "rotate by " << (std::abs(slope) * 45.0)
            << " degrees " << (slope < 0 ? "counterclockwise"
                               : "clockwise") << endl;
       sl.rotateViewPort(slope);
-      lines = sl.obtainGridlines();
-      sl.accumulateHorizontalLines(lines);
+      sl.findHorizontalLines(config);
     }
   }
 }
 
-SheetLine::SheetLine(const Rect& r, const Mat& page) {
+SheetLine::SheetLine(const Rect& r, const Mat& page,
+                     const Mat& staffFreePage, const Size& kernel,
+                     const StaffMetrics& metrics)
+  : staffKernel(kernel), staffMetrics(metrics) {
   innerBox = r;
-  boundingBox = BoundingBox(r, page.rows, page.cols);
-  viewPort = page(boundingBox).clone();
+  boundingBox = BoundingBox(r, page.rows, page.cols, staffMetrics);
+  viewPort = page(boundingBox);
+  staffFreeViewPort = staffFreePage(boundingBox);
+}
+
+void SheetLine::setInk(const Mat& inkPage, const Mat& staffFreeInkPage) {
+  ink = inkPage(boundingBox);
+  staffFreeInk = staffFreeInkPage(boundingBox);
 }
 
-Rect SheetLine::BoundingBox(const Rect& r, int rows, int cols) {
-  const int top = std::max(0, r.tl().y - verticalPaddingPx);
-  const int bottom = std::min(rows, r.br().y + verticalPaddingPx);
-  const int left = std::max(0, r.tl().x - horizontalPaddingPx);
-  const int right = std::min(cols, r.br().x + horizontalPaddingPx);
+Rect SheetLine::BoundingBox(const Rect& r, int rows, int cols,
+                            const StaffMetrics& staffMetrics) {
+  const int vertical = staffMetrics.scaled(verticalPaddingPx);
+  const int horizontal = staffMetrics.scaled(horizontalPaddingPx);
+  const int top = std::max(0, r.tl().y - vertical);
+  const int bottom = std::min(rows, r.br().y + vertical);
+  const int left = std::max(0, r.tl().x - horizontal);
+  const int right = std::min(cols, r.br().x + horizontal);
   return Rect(Point(left, top), Point(right, bottom));
 }
 
@@ -119,14 +174,19 @@ void SheetLine::setShapeFinder(ShapeFinder* sf) {
   shapeFinder.reset(sf);
 }
 
+void SheetLine::findHorizontalLines(const SheetConfig& config) {
+  if (config.gridEngine == SheetConfig::PROJECTION) {
+    projectHorizontalLines(config);
+  } else {
+    accumulateHorizontalLines(obtainGridlines());
+  }
+}
+
 vector<Vec4i> SheetLine::obtainGridlines() const {
   const Rect relative = innerBox - boundingBox.tl();
   Mat tmp = viewPort.clone();
   const int edHorizontalWidth = tmp.cols / 30;
-  const Mat horizontalStructure = getStructuringElement(MORPH_RECT,
-    Size(edHorizontalWidth, 1));
-  dilate(tmp, tmp, horizontalStructure, Point(-1, -1));
-  erode(tmp, tmp, horizontalStructure, Point(-1, -1));
+  closeRect(tmp, tmp, Size(edHorizontalWidth, 1));
   GaussianBlur(tmp, tmp, Size(3, 3), 0, 0); 
 
   // Might be better off with histogram equalization here for
@@ -197,7 +257,165 @@ void SheetLine::accumulateHorizontalLines(const vector<Vec4i>& lines) {
     }
     horizontals.emplace_back(Vec4i(lp.x, lp.y, rp.x, rp.y));
   }
+  selectHorizontalLines(horizontals);
+}
+
+void SheetLine::projectHorizontalLines(const SheetConfig& config) {
+  horizontalLines.clear();
+  const Rect relative = innerBox - boundingBox.tl();
+  const int strips = std::max(1, std::min(config.projectionStrips,
+                                          relative.width));
+  const Mat lineMask = findLineMask(config);
+
+  // Row profiles of the strips.
+  vector<Mat> profiles(strips);
+  vector<float> centres(strips);
+  int stripWidth = 0;
+  for (int s = 0; s < strips; s++) {
+    const int left = relative.x + s * relative.width / strips;
+    const int right = relative.x + (s + 1) * relative.width / strips;
+    reduce(lineMask(Rect(left, relative.y, right - left, relative.height)),
+           profiles[s], 1, REDUCE_SUM, CV_32S);
+    centres[s] = (left + right) / 2.0f;
+    stripWidth = right - left;
+  }
+
+  // How far the lines move up or down from one strip to the next: the
+  // shift that best lines up the neighbouring profiles. offsets[s] is
+  // the total shift from the first strip.
+  const int maxShift = std::max(1, cvRound(0.05 * stripWidth));
+  vector<int> offsets(strips, 0);
+  for (int s = 1; s < strips; s++) {
+    const Mat& a = profiles[s - 1];
+    const Mat& b = profiles[s];
+    double bestScore = -1.0;
+    int bestShift = 0;
+    for (int d = -maxShift; d <= maxShift; d++) {
+      double score = 0.0;
+      for (int y = std::max(0, -d); y < a.rows && y + d < b.rows; y++) {
+        score += (double)a.at<int>(y) * b.at<int>(y + d);
+      }
+      if (score > bestScore) {
+        bestScore = score;
+        bestShift = d;
+      }
+    }
+    offsets[s] = offsets[s - 1] + bestShift;
+  }
+
+  // A staff line running through the strips, as the positions where it
+  // was found in each of them.
+  struct Chain {
+    vector<Point2f> points;
+    int lastStrip;
+  };
+  vector<Chain> chains;
+  // How far a line may be from where the shifts say it should be.
+  const float maxDistance = 2.5f;
+  for (int s = 0; s < strips; s++) {
+    const Mat& profile = profiles[s];
+    const int minimum = (int)(config.projectionCoverage * stripWidth * 255);
+    // Each run of covered rows is one line, at its weighted centre.
+    for (int y = 0; y < profile.rows; y++) {
+      if (profile.at<int>(y) < minimum) continue;
+      double sum = 0, weighted = 0;
+      for (; y < profile.rows && profile.at<int>(y) >= minimum; y++) {
+        sum += profile.at<int>(y);
+        weighted += (double)profile.at<int>(y) * y;
+      }
+      const float ly = relative.y + (float)(weighted / sum);
+      Chain* best = nullptr;
+      float bestDistance = maxDistance;
+      for (auto& c : chains) {
+        if (c.lastStrip == s) continue;
+        const float expected =
+            c.points.back().y + offsets[s] - offsets[c.lastStrip];
+        const float d = std::abs(expected - ly);
+        if (d <= bestDistance) {
+          best = &c;
+          bestDistance = d;
+        }
+      }
+      if (best != nullptr) {
+        best->points.emplace_back(centres[s], ly);
+        best->lastStrip = s;
+      } else {
+        chains.push_back({{Point2f(centres[s], ly)}, s});
+      }
+    }
+  }
+
+  // Keep lines found in most strips, and fit a straight line through
+  // each one.
+  vector<Vec4i> horizontals;
+  for (const auto& c : chains) {
+    if (2 * c.points.size() < (size_t)strips + 1) continue;
+    float slope = 0.0f;
+    float meanX = 0.0f, meanY = 0.0f;
+    for (const auto& p : c.points) { meanX += p.x; meanY += p.y; }
+    meanX /= c.points.size();
+    meanY /= c.points.size();
+    if (c.points.size() > 1) {
+      float sxy = 0.0f, sxx = 0.0f;
+      for (const auto& p : c.points) {
+        sxy += (p.x - meanX) * (p.y - meanY);
+        sxx += (p.x - meanX) * (p.x - meanX);
+      }
+      slope = sxy / sxx;
+    }
+    const int left = relative.tl().x, right = relative.br().x - 1;
+    horizontals.emplace_back(
+        left, cvRound(meanY + slope * (left - meanX)),
+        right, cvRound(meanY + slope * (right - meanX)));
+  }
+  std::sort(horizontals.begin(), horizontals.end(), musicocr::moreTop);
+  selectHorizontalLines(horizontals);
+}
 
+bool SheetLine::hasPeriodicRows(const SheetConfig& config) {
+  const Rect relative = innerBox - boundingBox.tl();
+  // The long horizontal lines on their background, as in findLineMask.
+  const Mat lines = viewPort(relative) + ~staffFreeViewPort(relative);
+  const int strips = std::max(1, std::min(config.periodicityStrips,
+                                          relative.width));
+  // Rows are compared to the mean of the rows around them, which keeps
+  // the thin staff lines and drops shading and anything tall.
+  const int window = 2 * staffMetrics.scaled(3) + 1;
+  const int minShift = staffMetrics.scaled(3);
+  const int maxShift = relative.height / 4;
+  for (int s = 0; s < strips; s++) {
+    const int left = s * relative.width / strips;
+    const int right = (s + 1) * relative.width / strips;
+    Mat profile, smooth;
+    reduce(lines.colRange(left, right), profile, 1, REDUCE_AVG, CV_32F);
+    blur(profile, smooth, Size(1, window), Point(-1, -1), BORDER_REPLICATE);
+    const Mat rows = smooth - profile;
+    const double energy = rows.dot(rows);
+    if (std::sqrt(energy / rows.rows) < config.minPeriodicContrast) continue;
+    for (int shift = minShift; shift <= maxShift; shift++) {
+      const double correlation =
+          rows.rowRange(0, rows.rows - shift).dot(
+              rows.rowRange(shift, rows.rows)) / energy;
+      if (correlation >= config.minPeriodicity) return true;
+    }
+  }
+  periodicRows = false;
+  realMusicLine = false;
+  return false;
+}
+
+Mat SheetLine::findLineMask(const SheetConfig& config) const {
+  // Undo the staff removal to get just the long horizontal lines on
+  // their background, and mark the pixels clearly darker than what is
+  // just above or below them.
+  const Mat lines = viewPort + ~staffFreeViewPort;
+  Mat background, contrast;
+  dilateRect(lines, background, Size(1, config.projectionKernel));
+  subtract(background, lines, contrast);
+  return contrast >= config.projectionContrast;
+}
+
+void SheetLine::selectHorizontalLines(const vector<Vec4i>& horizontals) {
   if (horizontals.size() < minHorizontalLines) {
     cout << "only " << horizontals.size() << " lines after merging, want " << minHorizontalLines << endl;
     realMusicLine = false;
@@ -335,14 +553,141 @@ std::pair<int, int> SheetLine::getCoordinates() const {
   return std::make_pair(horizontalLines[0][1], horizontalLines.back()[1]);
 }
 
+void SheetLine::fitShear(const SheetConfig& config) {
+  shear.clear();
+  if (!realMusicLine || horizontalLines.size() < 2) return;
+  const Rect relative = innerBox - boundingBox.tl();
+  const Mat lineMask = findLineMask(config);
+  const int strips = std::max(1, std::min(config.shearStrips, relative.width));
+  const int count = horizontalLines.size();
+  // Look for each staff line at most half way to its neighbours from
+  // where the straight line found so far says it is.
+  const float spacing = (float)(horizontalLines.back()[1] -
+                                horizontalLines[0][1]) / (count - 1);
+  const int window = std::max(1, (int)(spacing / 2.0f) - 1);
+
+  // Where each staff line is in the middle of each strip.
+  struct Measurement {
+    float x, y;
+    int line;
+  };
+  vector<Measurement> measurements;
+  vector<int> perLine(count, 0);
+  for (int s = 0; s < strips; s++) {
+    const int left = relative.x + s * relative.width / strips;
+    const int right = relative.x + (s + 1) * relative.width / strips;
+    Mat profile;
+    reduce(lineMask(Rect(left, 0, right - left, lineMask.rows)), profile, 1,
+           REDUCE_SUM, CV_32S);
+    const float x = (left + right) / 2.0f;
+    const int minimum = (int)(config.projectionCoverage * (right - left) * 255);
+    for (int i = 0; i < count; i++) {
+      const Vec4i& l = horizontalLines[i];
+      const float predicted = l[2] == l[0] ? l[1] :
+          l[1] + (float)(l[3] - l[1]) * (x - l[0]) / (l[2] - l[0]);
+      const int from = std::max(0, cvRound(predicted) - window);
+      const int to = std::min(profile.rows - 1, cvRound(predicted) + window);
+      double sum = 0.0, weighted = 0.0;
+      int peak = 0;
+      for (int y = from; y <= to; y++) {
+        const int value = profile.at<int>(y);
+        sum += value;
+        weighted += (double)value * y;
+        peak = std::max(peak, value);
+      }
+      // A staff line that slants across the strip covers less of any
+      // one row, so this only asks for half the usual coverage.
+      if (2 * peak < minimum) continue;
+      measurements.push_back({x, (float)(weighted / sum), i});
+      perLine[i]++;
+    }
+  }
+  // The top and bottom line at least need to be found.
+  const int degree = std::max(1, config.shearDegree);
+  if (perLine.front() == 0 || perLine.back() == 0 ||
+      measurements.size() < (size_t)(count + degree + 1)) {
+    cout << "could not follow the staff lines for the shear fit." << endl;
+    return;
+  }
+
+  // Least squares for y = intercept[line] + sum c[k] u^k, u going from
+  // 0 to 1 across the inner box.
+  const int unknowns = count + degree;
+  Mat a = Mat::zeros(measurements.size(), unknowns, CV_64F);
+  Mat b(measurements.size(), 1, CV_64F);
+  for (size_t r = 0; r < measurements.size(); r++) {
+    const Measurement& m = measurements[r];
+    const double u = (m.x - relative.x) / relative.width;
+    a.at<double>(r, m.line) = 1.0;
+    double power = 1.0;
+    for (int k = 0; k < degree; k++) {
+      power *= u;
+      a.at<double>(r, count + k) = power;
+    }
+    b.at<double>(r) = m.y;
+  }
+  Mat solution;
+  solve(a, b, solution, DECOMP_SVD);
+  shearTop = solution.at<double>(0);
+  shearBottom = solution.at<double>(count - 1);
+  for (int k = 0; k < degree; k++) {
+    shear.push_back(solution.at<double>(count + k));
+  }
+}
+
+double SheetLine::getShearOffset(int x) const {
+  const Rect relative = innerBox - boundingBox.tl();
+  const double u = (double)(x - relative.x) / relative.width;
+  double offset = 0.0, power = 1.0;
+  for (double c : shear) {
+    power *= u;
+    offset += c * power;
+  }
+  return offset;
+}
+
+std::pair<int, int> SheetLine::getCoordinatesAt(int x) const {
+  if (shear.empty()) return getCoordinates();
+  const double offset = getShearOffset(x);
+  return std::make_pair(cvRound(shearTop + offset),
+                        cvRound(shearBottom + offset));
+}
+
 void SheetLine::rotateViewPort(float slope) {
   const Rect relative = innerBox - boundingBox.tl();
   rotationSlope = slope;
   const Point2f ctr((float)relative.tl().x, (float)relative.tl().y/2.0);
   Mat r = getRotationMatrix2D(ctr, (-1.0) * slope * 45.0, 1.0);
-  warpAffine(viewPort, viewPort, r,
-             Size(viewPort.cols, viewPort.rows),
-             cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  // Until now the viewport was a region of the page; the rotated one is
+  // a copy, with the pixels that don't map to anything left as they
+  // were.
+  Mat rotated = viewPort.clone();
+  if (source.empty()) {
+    warpAffine(viewPort, rotated, r,
+               Size(viewPort.cols, viewPort.rows),
+               cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  } else {
+    // Source to page, page to viewport, and the rotation, in one go, so
+    // the pixels are only interpolated once.
+    Mat rotation = Mat::eye(3, 3, CV_64F);
+    Mat affine = rotation.rowRange(0, 2);
+    r.copyTo(affine);
+    Mat shift = Mat::eye(3, 3, CV_64F);
+    shift.at<double>(0, 2) = -boundingBox.x;
+    shift.at<double>(1, 2) = -boundingBox.y;
+    const Mat m = rotation * shift * sourceTransform;
+    warpPerspective(source, rotated, m,
+                    Size(viewPort.cols, viewPort.rows),
+                    cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  }
+  viewPort = rotated;
+  // The staff lines were slanted in the page, so remove them again now
+  // that they are level. This no longer shares memory with the page.
+  staffFreeViewPort = removeHorizontalLines(viewPort, staffKernel);
+  // The page's ink doesn't line up with the rotated viewport any more;
+  // the stages go back to thresholding it themselves.
+  ink.release();
+  staffFreeInk.release();
 }
 
 
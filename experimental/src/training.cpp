@@ -1,4 +1,6 @@
 #include "training.hpp"
+#include "bitimage.hpp"
+#include "morphology.hpp"
 
 namespace musicocr {
 
@@ -8,7 +10,42 @@ namespace musicocr {
   using std::map;
 
 
+int SampleData::featureCount(FeatureType type) {
+  if (type == BITS) {
+    return 1 + zoneGrid * zoneGrid + 2 * profileBands + 4;
+  }
+  return imageSize * (imageSize + 1);
+}
+
+SampleData::FeatureType SampleData::featureTypeOf(
+    const cv::ml::StatModel& model) {
+  return model.getVarCount() == featureCount(BITS) ? BITS : PIXELS;
+}
+
 Mat SampleData::makeSampleMatrix(const Mat& smat, int xcoord, int ycoord) const {
+  if (preprocess) {
+    return makePreparedSampleMatrix(
+        staffFree ? smat : removeHorizontalLines(smat, cv::Size(10, 1)),
+        xcoord, ycoord);
+  }
+  if (featureType == BITS) {
+    return makeBitSampleMatrix(smat, xcoord, ycoord);
+  }
+  return finishSampleMatrix(smat, xcoord, ycoord);
+}
+
+Mat SampleData::makePreparedSampleMatrix(const Mat& lineFree,
+                                         int xcoord, int ycoord) const {
+  if (featureType == BITS) {
+    return makeBitSampleMatrix(lineFree, xcoord, ycoord);
+  }
+  Mat tmp;
+  threshold(lineFree, tmp, 0.0f, 255, 12);
+  tmp = ~tmp;
+  return finishSampleMatrix(tmp, xcoord, ycoord);
+}
+
+Mat SampleData::finishSampleMatrix(const Mat& smat, int xcoord, int ycoord) const {
   vector<float> sizeline(imageSize, 0.0);
   sizeline[0] = (float)smat.rows;
   sizeline[1] = (float)smat.cols;
@@ -16,23 +53,49 @@ Mat SampleData::makeSampleMatrix(const Mat& smat, int xcoord, int ycoord) const
   sizeline[3] = (float)ycoord;
 
   Mat ret;
-  if (preprocess) {
-    Mat horizontalStructure =  getStructuringElement(cv::MORPH_RECT, cv::Size(10, 1));
-    Mat tmp;
-    dilate(smat, tmp, horizontalStructure, cv::Point(-1, -1));
-    erode(tmp, tmp, horizontalStructure, cv::Point(-1, -1));
-    tmp = smat + ~tmp;
-    threshold(tmp, tmp, 0.0f, 255, 12);
-    tmp = ~tmp;
-    cv::resize(tmp, ret, cv::Size(imageSize, imageSize), 0, 0, cv::INTER_CUBIC);
-  } else {
-    cv::resize(smat, ret, cv::Size(imageSize, imageSize), 0, 0, cv::INTER_CUBIC);
-  }
+  cv::resize(smat, ret, cv::Size(imageSize, imageSize), 0, 0, cv::INTER_CUBIC);
   ret.convertTo(ret, CV_32F);
   ret.push_back(Mat(sizeline, true).t());
   return ret.reshape(1, 1);
 }
 
+Mat SampleData::makeBitSampleMatrix(const Mat& grey,
+                                    int xcoord, int ycoord) const {
+  Mat binary;
+  threshold(grey, binary, 0.0, 255, cv::THRESH_BINARY_INV + cv::THRESH_OTSU);
+  const BitImage ink(binary);
+  const cv::Rect rect(0, 0, grey.cols, grey.rows);
+  vector<float> sample;
+  sample.reserve(featureCount(BITS));
+  // Counts as a share of the zone they were taken in, scaled to 0-255
+  // like the pixels of PIXELS samples, so distances to the size and
+  // position weigh about the same.
+  auto addShares = [&](const vector<int>& counts, cv::Size grid) {
+    for (int j = 0; j < grid.height; j++) {
+      const int height = (j + 1) * rect.height / grid.height -
+                         j * rect.height / grid.height;
+      for (int i = 0; i < grid.width; i++) {
+        const int width = (i + 1) * rect.width / grid.width -
+                          i * rect.width / grid.width;
+        const int area = width * height;
+        sample.push_back(area > 0 ?
+            255.0f * counts[j * grid.width + i] / area : 0.0f);
+      }
+    }
+  };
+  addShares({ink.count(rect)}, cv::Size(1, 1));
+  const cv::Size zones(zoneGrid, zoneGrid), rows(1, profileBands),
+      columns(profileBands, 1);
+  addShares(ink.zoneCounts(rect, zones), zones);
+  addShares(ink.zoneCounts(rect, rows), rows);
+  addShares(ink.zoneCounts(rect, columns), columns);
+  sample.push_back((float)rect.height);
+  sample.push_back((float)rect.width);
+  sample.push_back((float)xcoord);
+  sample.push_back((float)ycoord);
+  return Mat(sample, true).reshape(1, 1);
+}
+
 void SampleData::addTrainingData(const cv::Mat& smat, int label,
                                  int xcoord, int ycoord,
 				 const string& basename) {
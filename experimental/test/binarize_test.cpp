@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include "binarize.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+// A staff, a few note heads and a bar line, drawn as 255 on 0.
+cv::Mat drawInk() {
+  cv::Mat ink = cv::Mat::zeros(120, 200, CV_8UC1);
+  for (int k = 0; k < 5; k++) {
+    cv::line(ink, cv::Point(10, 30 + 8 * k), cv::Point(189, 30 + 8 * k),
+             cv::Scalar(255), 1);
+  }
+  for (int x = 30; x < 190; x += 40) {
+    cv::circle(ink, cv::Point(x, 45), 3, cv::Scalar(255), -1);
+  }
+  cv::line(ink, cv::Point(100, 20), cv::Point(100, 90), cv::Scalar(255), 2);
+  return ink;
+}
+
+}  // namespace
+
+TEST(BinarizeTestSuite, TestSauvolaWithUnevenLighting) {
+  // Paper going from dark grey on the left to white on the right, with
+  // ink at about a third of the paper's brightness.
+  const cv::Mat ink = drawInk();
+  cv::Mat grey(ink.size(), CV_8UC1);
+  for (int y = 0; y < grey.rows; y++) {
+    for (int x = 0; x < grey.cols; x++) {
+      const double paper = 90.0 + 160.0 * x / (grey.cols - 1);
+      grey.at<uchar>(y, x) =
+          cv::saturate_cast<uchar>(ink.at<uchar>(y, x) ? 0.35 * paper : paper);
+    }
+  }
+  // One threshold for the whole image takes the dark side for ink.
+  cv::Mat otsu;
+  cv::threshold(grey, otsu, 0, 255, cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+  EXPECT_GT(cv::countNonZero(otsu != ink), 1000);
+
+  const cv::Mat sauvola = musicocr::sauvolaInk(grey, 31, 0.2);
+  EXPECT_EQ(0, cv::countNonZero(sauvola != ink));
+  // Plain paper has no ink.
+  EXPECT_EQ(0, cv::countNonZero(
+      musicocr::sauvolaInk(cv::Mat(50, 50, CV_8UC1, cv::Scalar(200)), 31, 0.2)));
+}
+
+TEST(BinarizeTestSuite, TestRemoveHorizontalInk) {
+  const cv::Mat ink = drawInk();
+  const cv::Mat staffFree = musicocr::removeHorizontalInk(ink, 20);
+  // No staff line pixels left between the note heads and the bar line...
+  for (int k = 0; k < 5; k++) {
+    EXPECT_EQ(0, staffFree.at<uchar>(30 + 8 * k, 60)) << "line " << k;
+    EXPECT_EQ(0, staffFree.at<uchar>(30 + 8 * k, 140)) << "line " << k;
+  }
+  // ...but the note heads and the bar line are still there.
+  for (int x = 30; x < 190; x += 40) {
+    EXPECT_EQ(255, staffFree.at<uchar>(45, x)) << "note at " << x;
+  }
+  EXPECT_EQ(255, staffFree.at<uchar>(25, 100));
+  EXPECT_EQ(255, staffFree.at<uchar>(85, 100));
+  // Nothing that wasn't ink.
+  EXPECT_EQ(0, cv::countNonZero(staffFree & ~ink));
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "bitimage.hpp"
+#include "training.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+cv::Mat randomBinary(cv::RNG& rng, int rows, int cols) {
+  cv::Mat image(rows, cols, CV_8UC1);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+  cv::threshold(image, image, 128, 255, cv::THRESH_BINARY);
+  return image;
+}
+
+}  // namespace
+
+TEST(BitImageTestSuite, TestCountSameAsCountNonZero) {
+  cv::RNG rng(2024);
+  // Widths below, at and across word boundaries.
+  for (int cols : {1, 63, 64, 65, 130, 200}) {
+    const cv::Mat image = randomBinary(rng, 17, cols);
+    const musicocr::BitImage bits(image);
+    EXPECT_EQ(cv::countNonZero(image), bits.count(cv::Rect(0, 0, cols, 17)));
+    EXPECT_EQ(0, cv::countNonZero(bits.toMat() != image)) << cols;
+    for (int i = 0; i < 50; i++) {
+      const int x = rng.uniform(0, cols);
+      const int y = rng.uniform(0, 17);
+      const cv::Rect r(x, y, rng.uniform(1, cols - x + 1),
+                       rng.uniform(1, 17 - y + 1));
+      EXPECT_EQ(cv::countNonZero(image(r)), bits.count(r))
+          << r << " in " << cols << " columns";
+    }
+  }
+}
+
+TEST(BitImageTestSuite, TestZoneCounts) {
+  cv::RNG rng(7);
+  const cv::Mat image = randomBinary(rng, 40, 150);
+  const musicocr::BitImage bits(image);
+  const cv::Rect rect(13, 5, 121, 31);
+  const cv::Size grid(5, 4);
+  const std::vector<int> counts = bits.zoneCounts(rect, grid);
+  ASSERT_EQ(20u, counts.size());
+  for (int j = 0; j < grid.height; j++) {
+    for (int i = 0; i < grid.width; i++) {
+      const int left = rect.x + i * rect.width / grid.width;
+      const int right = rect.x + (i + 1) * rect.width / grid.width;
+      const int top = rect.y + j * rect.height / grid.height;
+      const int bottom = rect.y + (j + 1) * rect.height / grid.height;
+      const cv::Rect zone(cv::Point(left, top), cv::Point(right, bottom));
+      EXPECT_EQ(cv::countNonZero(image(zone)), counts[j * grid.width + i])
+          << "zone " << i << ", " << j;
+    }
+  }
+  // Zones smaller than a pixel are empty.
+  const std::vector<int> thin = bits.zoneCounts(cv::Rect(0, 0, 3, 2),
+                                                cv::Size(5, 5));
+  int total = 0;
+  for (int n : thin) total += n;
+  EXPECT_EQ(cv::countNonZero(image(cv::Rect(0, 0, 3, 2))), total);
+}
+
+TEST(BitImageTestSuite, TestBitSamples) {
+  // A black ring on white.
+  cv::Mat crop(21, 21, CV_8UC1, cv::Scalar(255));
+  cv::circle(crop, cv::Point(10, 10), 8, cv::Scalar(0), 2);
+
+  musicocr::SampleData sd;
+  sd.setFeatureType(musicocr::SampleData::BITS);
+  const cv::Mat sample = sd.makeSampleMatrix(crop, 90, 20);
+  ASSERT_EQ(musicocr::SampleData::featureCount(musicocr::SampleData::BITS),
+            sample.cols);
+  EXPECT_EQ(1, sample.rows);
+  EXPECT_NE(musicocr::SampleData::featureCount(musicocr::SampleData::BITS),
+            musicocr::SampleData::featureCount(musicocr::SampleData::PIXELS));
+  // The share of ink comes first, the size and position last.
+  EXPECT_FLOAT_EQ(255.0f * cv::countNonZero(crop == 0) / crop.total(),
+                  sample.at<float>(0, 0));
+  EXPECT_FLOAT_EQ(21.0f, sample.at<float>(0, sample.cols - 4));
+  EXPECT_FLOAT_EQ(90.0f, sample.at<float>(0, sample.cols - 2));
+  // The ring has no ink in the middle zone.
+  EXPECT_FLOAT_EQ(0.0f, sample.at<float>(0, 1 + 12));
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+
+#include "components.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+std::vector<cv::Rect> contourBoxes(const cv::Mat& binary) {
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Vec4i> hierarchy;
+  cv::findContours(binary.clone(), contours, hierarchy, cv::RETR_TREE,
+                   cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+  std::vector<cv::Rect> boxes;
+  for (const auto& c : contours) {
+    std::vector<cv::Point> hull;
+    cv::convexHull(cv::Mat(c), hull, false);
+    boxes.push_back(cv::boundingRect(cv::Mat(hull)));
+  }
+  return boxes;
+}
+
+bool rectLess(const cv::Rect& a, const cv::Rect& b) {
+  if (a.x != b.x) return a.x < b.x;
+  if (a.y != b.y) return a.y < b.y;
+  if (a.width != b.width) return a.width < b.width;
+  return a.height < b.height;
+}
+
+}  // namespace
+
+TEST(ComponentsTestSuite, TestSameBoxesAsContours) {
+  cv::RNG rng(12345);
+  for (int i = 0; i < 50; i++) {
+    cv::Mat noise(20 + i, 30 + 2 * i, CV_8UC1);
+    rng.fill(noise, cv::RNG::UNIFORM, 0, 256);
+    cv::Mat binary;
+    cv::threshold(noise, binary, 150, 255, cv::THRESH_BINARY);
+
+    std::vector<cv::Rect> expected = contourBoxes(binary);
+    std::vector<cv::Rect> actual;
+    for (const auto& c : musicocr::findComponents(binary, true)) {
+      actual.push_back(c.box);
+    }
+    std::sort(expected.begin(), expected.end(), rectLess);
+    std::sort(actual.begin(), actual.end(), rectLess);
+    EXPECT_EQ(expected, actual) << "random image " << i;
+  }
+}
+
+TEST(ComponentsTestSuite, TestStatistics) {
+  // A 5x3 block with a hole in the middle, and a single pixel.
+  cv::Mat binary = cv::Mat::zeros(10, 10, CV_8UC1);
+  binary(cv::Rect(2, 2, 5, 3)).setTo(255);
+  binary.at<uchar>(3, 4) = 0;
+  binary.at<uchar>(8, 8) = 255;
+
+  std::vector<musicocr::ComponentStats> stats =
+      musicocr::findComponents(binary, true);
+  ASSERT_EQ(3, stats.size());
+
+  const musicocr::ComponentStats& block = stats[0];
+  EXPECT_FALSE(block.hole);
+  EXPECT_EQ(cv::Rect(2, 2, 5, 3), block.box);
+  EXPECT_EQ(14, block.area);
+  const cv::Moments m = cv::moments(binary(cv::Rect(0, 0, 8, 8)), true);
+  EXPECT_DOUBLE_EQ(m.m10 / m.m00, block.centroid.x);
+  EXPECT_DOUBLE_EQ(m.m01 / m.m00, block.centroid.y);
+  EXPECT_DOUBLE_EQ(m.m20, block.m20);
+  EXPECT_DOUBLE_EQ(m.m11, block.m11);
+  EXPECT_DOUBLE_EQ(m.m02, block.m02);
+
+  const musicocr::ComponentStats& hole = stats[1];
+  EXPECT_TRUE(hole.hole);
+  EXPECT_EQ(cv::Rect(3, 2, 3, 3), hole.box);
+  EXPECT_EQ(1, hole.area);
+
+  EXPECT_EQ(cv::Rect(8, 8, 1, 1), stats[2].box);
+  EXPECT_EQ(cv::Point2d(8, 8), stats[2].centroid);
+
+  // Without holes, only the two components are left.
+  EXPECT_EQ(2, musicocr::findComponents(binary, false).size());
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <vector>
+
+#include "hough.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+bool closeTo(const cv::Vec4i& line, const cv::Vec4i& expected, int tolerance) {
+  // Segments may come out in either direction.
+  const cv::Vec4i reversed(expected[2], expected[3], expected[0], expected[1]);
+  for (const auto& e : {expected, reversed}) {
+    bool close = true;
+    for (int i = 0; i < 4; i++) {
+      close = close && std::abs(line[i] - e[i]) <= tolerance;
+    }
+    if (close) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST(HoughTestSuite, TestSameAsOpenCVWithFullBand) {
+  cv::RNG rng(1234);
+  cv::Mat edges = cv::Mat::zeros(240, 320, CV_8UC1);
+  for (int i = 0; i < 12; i++) {
+    cv::line(edges, cv::Point(rng.uniform(0, 320), rng.uniform(0, 240)),
+             cv::Point(rng.uniform(0, 320), rng.uniform(0, 240)),
+             cv::Scalar(255));
+  }
+  std::vector<cv::Vec4i> expected, actual;
+  cv::HoughLinesP(edges, expected, 1, CV_PI/180.0, 30, 20, 5);
+  musicocr::houghLinesBanded(edges, actual, 1, CV_PI/180.0, 30, 20, 5, 90.0);
+  // Within a pixel or two, so that rounding differently somewhere
+  // doesn't fail the test.
+  for (const auto& e : expected) {
+    bool found = false;
+    for (const auto& l : actual) found = found || closeTo(l, e, 2);
+    EXPECT_TRUE(found) << "missing " << e;
+  }
+  for (const auto& l : actual) {
+    bool found = false;
+    for (const auto& e : expected) found = found || closeTo(l, e, 2);
+    EXPECT_TRUE(found) << "extra " << l;
+  }
+}
+
+TEST(HoughTestSuite, TestOnlyNearAxisLines) {
+  cv::Mat edges = cv::Mat::zeros(200, 300, CV_8UC1);
+  const std::vector<cv::Vec4i> axisLines = {
+    cv::Vec4i(20, 30, 270, 30), cv::Vec4i(20, 170, 270, 170),
+    cv::Vec4i(40, 10, 40, 190), cv::Vec4i(250, 10, 250, 190)
+  };
+  for (const auto& l : axisLines) {
+    cv::line(edges, cv::Point(l[0], l[1]), cv::Point(l[2], l[3]),
+             cv::Scalar(255));
+  }
+  // A diagonal, which should not be found.
+  cv::line(edges, cv::Point(80, 50), cv::Point(200, 170), cv::Scalar(255));
+
+  std::vector<cv::Vec4i> lines;
+  musicocr::houghLinesBanded(edges, lines, 1, CV_PI/180.0, 50, 100, 5, 10.0);
+  for (const auto& expected : axisLines) {
+    bool found = false;
+    for (const auto& l : lines) found = found || closeTo(l, expected, 3);
+    EXPECT_TRUE(found) << expected;
+  }
+  for (const auto& l : lines) {
+    EXPECT_TRUE(std::abs(l[2] - l[0]) < 10 || std::abs(l[3] - l[1]) < 10)
+        << l;
+  }
+}
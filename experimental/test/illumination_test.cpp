@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "illumination.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+// White paper lit from the left, fading to a dull grey on the right,
+// with short black strokes all over it.
+cv::Mat unevenPage(cv::Mat* ink) {
+  cv::Mat page(200, 320, CV_8UC1);
+  for (int x = 0; x < page.cols; x++) {
+    page.col(x).setTo(240 - x * 150 / page.cols);
+  }
+  *ink = cv::Mat::zeros(page.size(), CV_8UC1);
+  for (int y = 10; y < page.rows - 10; y += 20) {
+    for (int x = 10; x < page.cols - 10; x += 30) {
+      cv::line(*ink, cv::Point(x, y), cv::Point(x + 12, y + 6),
+               cv::Scalar(255), 2);
+    }
+  }
+  cv::Mat dark = page * 0.2;
+  dark.copyTo(page, *ink);
+  return page;
+}
+
+}  // namespace
+
+TEST(IlluminationTestSuite, TestBackgroundIgnoresInk) {
+  cv::Mat ink;
+  const cv::Mat page = unevenPage(&ink);
+  const cv::Mat background = musicocr::estimateBackground(page);
+  ASSERT_EQ(page.size(), background.size());
+  ASSERT_EQ(CV_8UC1, background.type());
+  // Close to the paper, strokes or not. (The closing takes the lighter
+  // paper past the darkest edge, so leave that out.)
+  for (int x = 16; x < page.cols - 48; x += 8) {
+    const int paper = 240 - x * 150 / page.cols;
+    for (int y = 16; y < page.rows - 16; y += 8) {
+      EXPECT_NEAR(paper, background.at<uchar>(y, x), 12) << x << "," << y;
+    }
+  }
+}
+
+TEST(IlluminationTestSuite, TestNormalizedPaperIsFlat) {
+  cv::Mat ink;
+  const cv::Mat page = unevenPage(&ink);
+  const cv::Mat normalized = musicocr::normalizeIllumination(page);
+  const cv::Rect inner(16, 16, page.cols - 32, page.rows - 32);
+  const cv::Mat paper = ~ink(inner);
+  double low, high;
+  cv::minMaxLoc(page(inner), &low, &high, nullptr, nullptr, paper);
+  EXPECT_GT(high - low, 100);
+  cv::minMaxLoc(normalized(inner), &low, &high, nullptr, nullptr, paper);
+  EXPECT_LT(high - low, 50);
+  EXPECT_GT(low, 200);
+
+  // One global threshold now separates ink and paper everywhere.
+  const cv::Mat found = normalized(inner) < 128;
+  EXPECT_EQ(0, cv::countNonZero(found != ink(inner)));
+}
+
+TEST(IlluminationTestSuite, TestKeepsEvenlyLitPage) {
+  cv::Mat page(60, 80, CV_8UC1, cv::Scalar(255));
+  page(cv::Rect(30, 20, 4, 20)).setTo(0);
+  const cv::Mat normalized = musicocr::normalizeIllumination(page);
+  EXPECT_EQ(0, cv::countNonZero(normalized != page));
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+#include "imageio.hpp"
+#include "opencv2/opencv.hpp"
+
+TEST(ImageIoTestSuite, TestReducedReadFlag) {
+  int reduction;
+  EXPECT_EQ(cv::IMREAD_GRAYSCALE, musicocr::reducedReadFlag(1.0, &reduction));
+  EXPECT_EQ(1, reduction);
+  EXPECT_EQ(cv::IMREAD_GRAYSCALE, musicocr::reducedReadFlag(0.6, &reduction));
+  EXPECT_EQ(1, reduction);
+  EXPECT_EQ(cv::IMREAD_REDUCED_GRAYSCALE_2,
+            musicocr::reducedReadFlag(0.5, &reduction));
+  EXPECT_EQ(2, reduction);
+  EXPECT_EQ(cv::IMREAD_REDUCED_GRAYSCALE_4,
+            musicocr::reducedReadFlag(0.2, &reduction));
+  EXPECT_EQ(4, reduction);
+  EXPECT_EQ(cv::IMREAD_REDUCED_GRAYSCALE_8,
+            musicocr::reducedReadFlag(0.125, &reduction));
+  EXPECT_EQ(8, reduction);
+  // Nothing beyond 1/8.
+  EXPECT_EQ(cv::IMREAD_REDUCED_GRAYSCALE_8,
+            musicocr::reducedReadFlag(0.05, &reduction));
+  EXPECT_EQ(8, reduction);
+}
+
+TEST(ImageIoTestSuite, TestSameAsFullDecode) {
+  const char *buffer = getcwd(NULL, 0);
+  const std::string test_file =
+      std::string(buffer) + "/test/data/sample1.jpg";
+  cv::Mat image = cv::imread(test_file);
+  ASSERT_TRUE(image.data != NULL);
+  cv::Mat gray;
+  resize(image, image, cv::Size(), 0.2, 0.2, cv::INTER_AREA);
+  cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+  const cv::Mat reduced = musicocr::loadGrayscale(test_file, 0.2);
+  ASSERT_EQ(CV_8UC1, reduced.type());
+  EXPECT_LE(std::abs(reduced.cols - gray.cols), 1);
+  EXPECT_LE(std::abs(reduced.rows - gray.rows), 1);
+  const cv::Rect common(0, 0, std::min(reduced.cols, gray.cols),
+                        std::min(reduced.rows, gray.rows));
+  cv::Mat difference;
+  cv::absdiff(reduced(common), gray(common), difference);
+  // The details differ a little, the brightness doesn't.
+  EXPECT_LT(cv::mean(difference)[0], 5.0);
+  EXPECT_NEAR(cv::mean(gray(common))[0], cv::mean(reduced(common))[0], 1.0);
+}
+
+TEST(ImageIoTestSuite, TestMissingFile) {
+  EXPECT_TRUE(musicocr::loadGrayscale("no/such/file.jpg", 0.2).empty());
+}
+
+TEST(ImageIoTestSuite, TestExifOrientation) {
+  const std::string directory = std::string(getcwd(NULL, 0)) + "/test/data/";
+  EXPECT_EQ(1, musicocr::readExifOrientation(directory + "DSC_0130.jpg"));
+  EXPECT_EQ(3, musicocr::readExifOrientation(directory + "sample1.jpg"));
+  EXPECT_EQ(6, musicocr::readExifOrientation(directory + "DSC_0171.jpg"));
+  // Not a JPEG, or not there at all.
+  EXPECT_EQ(0, musicocr::readExifOrientation(directory + "list"));
+  EXPECT_EQ(0, musicocr::readExifOrientation(directory + "no_such.jpg"));
+
+  // A big-endian EXIF segment with nothing but the orientation in it,
+  // after a comment segment.
+  unsigned char header[] = {
+      0xFF, 0xD8,
+      0xFF, 0xFE, 0x00, 0x04, 'h', 'i',
+      0xFF, 0xE1, 0x00, 0x22, 'E', 'x', 'i', 'f', 0, 0,
+      'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,
+      0x00, 0x01,
+      0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00,
+      0xFF, 0xD9};
+  const std::string file = std::string(getcwd(NULL, 0)) + "/exif_test.jpg";
+  {
+    std::ofstream out(file, std::ios::binary);
+    out.write((const char*)header, sizeof(header));
+  }
+  EXPECT_EQ(8, musicocr::readExifOrientation(file));
+
+  // The same with the directory offset at 0xFFFFFFFF, which wraps
+  // around to 1 when 2 is added in 32 bits.
+  std::fill(header + 22, header + 26, 0xFF);
+  {
+    std::ofstream out(file, std::ios::binary);
+    out.write((const char*)header, sizeof(header));
+  }
+  EXPECT_EQ(0, musicocr::readExifOrientation(file));
+  std::remove(file.c_str());
+}
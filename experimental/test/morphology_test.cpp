@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+
+#include "morphology.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+bool sameImage(const cv::Mat& a, const cv::Mat& b) {
+  return a.size() == b.size() && a.type() == b.type() &&
+         cv::countNonZero(a != b) == 0;
+}
+
+}  // namespace
+
+TEST(MorphologyTestSuite, TestSameAsOpenCV) {
+  cv::RNG rng(4711);
+  // Fewer and more rows than rowPass interleaves at a time with SIMD,
+  // and widths that aren't a multiple of its 16 lanes.
+  for (int i = 0; i < 30; i++) {
+    cv::Mat image(5 + i, 40 + 7 * i, CV_8UC1);
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    if (i % 2 == 1) {
+      cv::threshold(image, image, 128, 255, cv::THRESH_BINARY);
+    }
+    // Even and odd widths, kernels wider than the image, and the
+    // kernel widths used for staff lines.
+    const std::vector<cv::Size> sizes = {
+      cv::Size(1, 1), cv::Size(2, 1), cv::Size(10, 1),
+      cv::Size(image.cols / 30, 1), cv::Size(image.cols + 5, 1),
+      cv::Size(1, 4), cv::Size(5, 3), cv::Size(6, image.rows + 2)
+    };
+    for (const auto& size : sizes) {
+      const cv::Mat kernel = cv::getStructuringElement(
+          cv::MORPH_RECT, cv::Size(std::max(1, size.width), size.height));
+      cv::Mat expected, actual;
+      cv::dilate(image, expected, kernel, cv::Point(-1, -1));
+      musicocr::dilateRect(image, actual, size);
+      EXPECT_TRUE(sameImage(expected, actual))
+          << "dilate " << size << " image " << i;
+
+      cv::erode(image, expected, kernel, cv::Point(-1, -1));
+      musicocr::erodeRect(image, actual, size);
+      EXPECT_TRUE(sameImage(expected, actual))
+          << "erode " << size << " image " << i;
+
+      cv::dilate(image, expected, kernel, cv::Point(-1, -1));
+      cv::erode(expected, expected, kernel, cv::Point(-1, -1));
+      musicocr::closeRect(image, actual, size);
+      EXPECT_TRUE(sameImage(expected, actual))
+          << "close " << size << " image " << i;
+    }
+  }
+}
+
+TEST(MorphologyTestSuite, TestRoiInPlace) {
+  // Views into a larger image (rows not continuous), with src == dst.
+  cv::RNG rng(42);
+  cv::Mat image(60, 200, CV_8UC1);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+  const cv::Rect roi(13, 7, 150, 40);
+  const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT,
+                                                   cv::Size(17, 1));
+  cv::Mat expected;
+  cv::dilate(image(roi), expected, kernel, cv::Point(-1, -1));
+  cv::erode(expected, expected, kernel, cv::Point(-1, -1));
+
+  cv::Mat view = image(roi);
+  musicocr::closeRect(view, view, cv::Size(17, 1));
+  EXPECT_TRUE(sameImage(expected, image(roi)));
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "quality.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+// Light grey paper with six staves of thick dark lines and a few notes.
+cv::Mat musicPage() {
+  cv::Mat page(480, 640, CV_8UC1, cv::Scalar(220));
+  for (int top = 40; top < 440; top += 80) {
+    for (int k = 0; k < 5; k++) {
+      page(cv::Rect(40, top + k * 8, 560, 2)).setTo(60);
+    }
+    for (int x = 80; x < 580; x += 40) {
+      cv::circle(page, cv::Point(x, top + 12 + (x / 40) % 4 * 4), 4,
+                 cv::Scalar(40), -1);
+    }
+  }
+  return page;
+}
+
+}  // namespace
+
+TEST(QualityTestSuite, TestGoodPage) {
+  const musicocr::QualityGate gate;
+  const cv::Mat page = musicPage();
+  const musicocr::QualityReport report = gate.check(page);
+  EXPECT_TRUE(report.usable()) << report.reason();
+  EXPECT_STREQ("ok", report.reason());
+  EXPECT_GT(report.ruledScore, 0.05);
+
+  // Turned by 90 degrees it's still a page of music.
+  cv::Mat turned;
+  cv::transpose(page, turned);
+  EXPECT_TRUE(gate.check(turned).usable());
+}
+
+TEST(QualityTestSuite, TestRejections) {
+  const musicocr::QualityGate gate;
+  const cv::Mat page = musicPage();
+
+  cv::Mat blurred;
+  cv::GaussianBlur(page, blurred, cv::Size(), 4.0);
+  EXPECT_EQ(musicocr::QualityReport::BLURRY, gate.check(blurred).problem);
+
+  const cv::Mat dark = page * 0.15;
+  EXPECT_EQ(musicocr::QualityReport::UNDEREXPOSED, gate.check(dark).problem);
+
+  const cv::Mat flat(480, 640, CV_8UC1, cv::Scalar(128));
+  EXPECT_EQ(musicocr::QualityReport::LOW_CONTRAST, gate.check(flat).problem);
+
+  // Sharp and well exposed, but text rather than staves.
+  cv::Mat text(480, 640, CV_8UC1, cv::Scalar(220));
+  for (int y = 30; y < 470; y += 22) {
+    cv::putText(text, "the quick brown fox jumps over a lazy dog",
+                cv::Point(20, y), cv::FONT_HERSHEY_SIMPLEX, 0.8,
+                cv::Scalar(40), 2);
+  }
+  const musicocr::QualityReport report = gate.check(text);
+  EXPECT_EQ(musicocr::QualityReport::NOT_RULED, report.problem);
+  EXPECT_STREQ("no staff lines", report.reason());
+}
@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include "regionstats.hpp"
+#include "opencv2/opencv.hpp"
+
+TEST(RegionStatsTestSuite, TestSameAsScanningTheRegion) {
+  cv::RNG rng(31);
+  cv::Mat grey(45, 120, CV_8UC1);
+  rng.fill(grey, cv::RNG::UNIFORM, 0, 256);
+  const cv::Mat ink = grey < 100;
+  const musicocr::RegionStats stats(grey, ink);
+  EXPECT_EQ(grey.size(), stats.size());
+
+  for (int i = 0; i < 100; i++) {
+    const int x = rng.uniform(0, grey.cols);
+    const int y = rng.uniform(0, grey.rows);
+    const cv::Rect r(x, y, rng.uniform(1, grey.cols - x + 1),
+                     rng.uniform(1, grey.rows - y + 1));
+    EXPECT_EQ(cv::countNonZero(ink(r)), stats.inkCount(r)) << r;
+    EXPECT_DOUBLE_EQ((double)cv::countNonZero(ink(r)) / r.area(),
+                     stats.inkDensity(r)) << r;
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(grey(r), mean, stddev);
+    EXPECT_NEAR(mean[0], stats.mean(r), 1e-9) << r;
+    EXPECT_NEAR(stddev[0], stats.stddev(r), 1e-6) << r;
+  }
+}
+
+TEST(RegionStatsTestSuite, TestClipping) {
+  cv::Mat grey(10, 10, CV_8UC1, cv::Scalar(200));
+  grey(cv::Rect(0, 0, 5, 10)).setTo(0);
+  const musicocr::RegionStats stats(grey, grey == 0);
+  // Only the part inside the image counts.
+  EXPECT_EQ(50, stats.inkCount(cv::Rect(-5, -5, 30, 30)));
+  EXPECT_DOUBLE_EQ(0.5, stats.inkDensity(cv::Rect(-5, 0, 20, 10)));
+  EXPECT_DOUBLE_EQ(100.0, stats.mean(cv::Rect(0, 0, 10, 10)));
+  EXPECT_EQ(0, stats.inkCount(cv::Rect(20, 20, 5, 5)));
+  EXPECT_DOUBLE_EQ(0.0, stats.mean(cv::Rect(20, 20, 5, 5)));
+  // No ink image: ink queries come back empty.
+  const musicocr::RegionStats greyOnly(grey, cv::Mat());
+  EXPECT_EQ(0, greyOnly.inkCount(cv::Rect(0, 0, 10, 10)));
+  EXPECT_DOUBLE_EQ(100.0, greyOnly.stddev(cv::Rect(0, 0, 10, 10)));
+}
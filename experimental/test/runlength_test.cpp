@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "runlength.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+bool sameImage(const cv::Mat& a, const cv::Mat& b) {
+  return a.size() == b.size() && a.type() == b.type() &&
+         cv::countNonZero(a != b) == 0;
+}
+
+cv::Mat randomBinary(cv::RNG& rng, int rows, int cols, int cutoff) {
+  cv::Mat image(rows, cols, CV_8UC1);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+  cv::threshold(image, image, cutoff, 255, cv::THRESH_BINARY);
+  return image;
+}
+
+}  // namespace
+
+TEST(RunLengthTestSuite, TestRoundTrip) {
+  cv::RNG rng(1234);
+  for (int i = 0; i < 20; i++) {
+    const cv::Mat image = randomBinary(rng, 3 + i, 10 + 5 * i, 60 + 8 * i);
+    const musicocr::RunLengthImage rle(image);
+    EXPECT_EQ(image.rows, rle.getRows());
+    EXPECT_EQ(image.cols, rle.getCols());
+    EXPECT_TRUE(sameImage(image, rle.toMat())) << "image " << i;
+  }
+  const musicocr::RunLengthImage empty(4, 7);
+  EXPECT_EQ(0u, empty.getRunCount());
+  EXPECT_TRUE(sameImage(cv::Mat::zeros(4, 7, CV_8UC1), empty.toMat()));
+}
+
+TEST(RunLengthTestSuite, TestMorphologySameAsOpenCV) {
+  cv::RNG rng(4711);
+  for (int i = 0; i < 20; i++) {
+    const cv::Mat image = randomBinary(rng, 5 + i, 40 + 7 * i, 100 + 5 * i);
+    const musicocr::RunLengthImage rle(image);
+    // Even and odd sizes, and kernels larger than the image.
+    for (int size : {1, 2, 3, 7, 10, image.cols + 5}) {
+      const cv::Mat horizontal =
+          cv::getStructuringElement(cv::MORPH_RECT, cv::Size(size, 1));
+      cv::Mat expected;
+      cv::dilate(image, expected, horizontal);
+      EXPECT_TRUE(sameImage(expected, rle.dilateHorizontal(size).toMat()))
+          << "dilate " << size << " image " << i;
+      cv::erode(image, expected, horizontal);
+      EXPECT_TRUE(sameImage(expected, rle.erodeHorizontal(size).toMat()))
+          << "erode " << size << " image " << i;
+      cv::morphologyEx(image, expected, cv::MORPH_CLOSE, horizontal);
+      EXPECT_TRUE(sameImage(expected, rle.closeHorizontal(size).toMat()))
+          << "close " << size << " image " << i;
+
+      const cv::Mat vertical =
+          cv::getStructuringElement(cv::MORPH_RECT, cv::Size(1, size));
+      cv::dilate(image, expected, vertical);
+      EXPECT_TRUE(sameImage(expected, rle.dilateVertical(size).toMat()))
+          << "dilate vertically " << size << " image " << i;
+    }
+  }
+}
+
+TEST(RunLengthTestSuite, TestProjections) {
+  cv::RNG rng(99);
+  const cv::Mat image = randomBinary(rng, 37, 53, 180);
+  const musicocr::RunLengthImage rle(image);
+  const std::vector<int> rows = rle.rowProjection();
+  const std::vector<int> columns = rle.columnProjection();
+  ASSERT_EQ((size_t)image.rows, rows.size());
+  ASSERT_EQ((size_t)image.cols, columns.size());
+  for (int y = 0; y < image.rows; y++) {
+    EXPECT_EQ(cv::countNonZero(image.row(y)), rows[y]) << "row " << y;
+  }
+  for (int x = 0; x < image.cols; x++) {
+    EXPECT_EQ(cv::countNonZero(image.col(x)), columns[x]) << "column " << x;
+  }
+}
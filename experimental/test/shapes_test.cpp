@@ -0,0 +1,324 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "morphology.hpp"
+#include "shapes.hpp"
+#include "training.hpp"
+#include "opencv2/opencv.hpp"
+
+TEST(ShapesTestSuite, TestParentsBeforeChildren) {
+  // A ring one pixel wide with a dot inside. The box of its hole, which
+  // is the box of the ring's inner border, starts at the same x as the
+  // ring's own box.
+  cv::Mat page(100, 800, CV_8UC1, cv::Scalar(255));
+  cv::rectangle(page, cv::Point(100, 30), cv::Point(120, 48),
+                cv::Scalar(60), 1);
+  page(cv::Rect(104, 35, 5, 5)).setTo(60);
+
+  for (auto segmentation : {musicocr::ContourConfig::CONTOURS,
+                            musicocr::ContourConfig::COMPONENTS}) {
+    musicocr::ContourConfig config;
+    config.gaussianKernel = 1;
+    config.segmentation = segmentation;
+    musicocr::ShapeFinder finder(config);
+    const std::vector<cv::Rect>& boxes = finder.getContourBoxes(page);
+    const std::vector<int>& parents = finder.getBoxParents();
+    ASSERT_EQ(3, boxes.size());
+    ASSERT_EQ(3, parents.size());
+    EXPECT_EQ(boxes[0].x, boxes[1].x);
+    EXPECT_EQ(-1, parents[0]);
+    EXPECT_EQ(0, parents[1]);
+    EXPECT_EQ(1, parents[2]);
+    EXPECT_EQ(cv::Rect(104, 35, 5, 5), boxes[2]);
+  }
+}
+
+TEST(ShapesTestSuite, TestEnclosedButNotNested) {
+  // An L with a dot in its corner: the dot's box is inside the L's, but
+  // the dot isn't in a hole of the L.
+  cv::Mat page(100, 800, CV_8UC1, cv::Scalar(255));
+  page(cv::Rect(100, 30, 3, 20)).setTo(60);
+  page(cv::Rect(100, 47, 20, 3)).setTo(60);
+  page(cv::Rect(110, 35, 4, 4)).setTo(60);
+  for (auto segmentation : {musicocr::ContourConfig::CONTOURS,
+                            musicocr::ContourConfig::COMPONENTS}) {
+    musicocr::ContourConfig config;
+    config.gaussianKernel = 1;
+    config.segmentation = segmentation;
+    musicocr::ShapeFinder finder(config);
+    const std::vector<cv::Rect>& boxes = finder.getContourBoxes(page);
+    ASSERT_EQ(2, boxes.size());
+    EXPECT_EQ(std::vector<int>({-1, -1}), finder.getBoxParents());
+  }
+
+  // Tested pairwise, the dot is in the L; going by the hierarchy, the
+  // two only overlap.
+  using Neighbourhood = musicocr::Shape::Neighbourhood;
+  musicocr::Shape pairwise(cv::Rect(100, 30, 20, 20));
+  musicocr::Shape dot(cv::Rect(110, 35, 4, 4));
+  pairwise.maybeAddNeighbour(&dot);
+  EXPECT_EQ(1, pairwise.getNeighbours().count(Neighbourhood::IN));
+  EXPECT_EQ(0, pairwise.getNeighbours().count(Neighbourhood::INTERSECT));
+
+  musicocr::Shape nested(cv::Rect(100, 30, 20, 20));
+  musicocr::Shape other(cv::Rect(110, 35, 4, 4));
+  nested.maybeAddNeighbour(&other, false);
+  EXPECT_EQ(0, nested.getNeighbours().count(Neighbourhood::IN));
+  ASSERT_EQ(1, nested.getNeighbours().count(Neighbourhood::INTERSECT));
+  EXPECT_EQ(&other, nested.getNeighbours().at(Neighbourhood::INTERSECT)[0]);
+}
+
+TEST(ShapesTestSuite, TestNeedsFineModel) {
+  using musicocr::TrainingKey;
+  musicocr::ShapeFinder finder((musicocr::ContourConfig()));
+  const cv::Rect small(0, 0, 3, 3), large(0, 0, 7, 6);
+
+  // Unsure: always ask, whatever the category.
+  TrainingKey::Category category = TrainingKey::Category::undefined;
+  EXPECT_TRUE(finder.needsFineModel(TrainingKey::TopLevelCategory::hline,
+                                    0.5f, large, &category));
+  EXPECT_EQ(TrainingKey::Category::undefined, category);
+
+  // Sure, and the category says it all.
+  EXPECT_FALSE(finder.needsFineModel(TrainingKey::TopLevelCategory::hline,
+                                     1.0f, large, &category));
+  EXPECT_EQ(TrainingKey::Category::connector, category);
+  EXPECT_FALSE(finder.needsFineModel(TrainingKey::TopLevelCategory::vline,
+                                     1.0f, large, &category));
+  EXPECT_EQ(TrainingKey::Category::vertical, category);
+  EXPECT_FALSE(finder.needsFineModel(TrainingKey::TopLevelCategory::round,
+                                     1.0f, small, &category));
+  EXPECT_EQ(TrainingKey::Category::speck, category);
+
+  // Sure, but the category needs refining.
+  category = TrainingKey::Category::undefined;
+  EXPECT_TRUE(finder.needsFineModel(TrainingKey::TopLevelCategory::round,
+                                    1.0f, large, &category));
+  EXPECT_TRUE(finder.needsFineModel(TrainingKey::TopLevelCategory::composite,
+                                    1.0f, large, &category));
+  EXPECT_TRUE(finder.needsFineModel(TrainingKey::TopLevelCategory::unknown,
+                                    1.0f, small, &category));
+  EXPECT_EQ(TrainingKey::Category::undefined, category);
+}
+
+TEST(ShapesTestSuite, TestConfidenceOnlyFromKnn) {
+  // Two neighbours of one label and one of another: with k = 3 the vote
+  // is 2 of 3. A decision tree has no votes to count.
+  const int count =
+      musicocr::SampleData::featureCount(musicocr::SampleData::PIXELS);
+  cv::Mat samples(3, count, CV_32F, cv::Scalar(0));
+  samples.row(2).setTo(10);
+  cv::Mat labels = (cv::Mat_<int>(3, 1) << 100, 100, 99);
+  const cv::Mat sample(1, count, CV_32F, cv::Scalar(1));
+
+  cv::Ptr<cv::ml::KNearest> knn = cv::ml::KNearest::create();
+  knn->setDefaultK(3);
+  knn->train(samples, cv::ml::ROW_SAMPLE, labels);
+  float confidence = 0.0f;
+  EXPECT_EQ(100.0f, musicocr::ShapeFinder::predictWithConfidence(
+      knn, sample, &confidence));
+  EXPECT_NEAR(2.0f / 3.0f, confidence, 1e-6);
+
+  cv::Ptr<cv::ml::DTrees> dtrees = cv::ml::DTrees::create();
+  dtrees->setMaxDepth(2);
+  dtrees->setMinSampleCount(1);
+  dtrees->setCVFolds(0);
+  dtrees->train(samples, cv::ml::ROW_SAMPLE, labels);
+  musicocr::ShapeFinder::predictWithConfidence(dtrees, sample, &confidence);
+  EXPECT_EQ(1.0f, confidence);
+}
+
+TEST(ShapesTestSuite, TestStaffFreeSamples) {
+  // A crop with a staff line through a note head, and the same crop
+  // with the line removed, as a region of the staff-free page is.
+  cv::Mat crop(12, 30, CV_8UC1, cv::Scalar(230));
+  crop.row(6).setTo(40);
+  crop(cv::Rect(12, 3, 6, 6)).setTo(40);
+  const cv::Mat staffFree =
+      musicocr::removeHorizontalLines(crop, cv::Size(10, 1));
+
+  musicocr::SampleData grey, free;
+  grey.setPreprocessing(true);
+  free.setPreprocessing(true);
+  free.setStaffFree(true);
+  // Only the line removal is skipped.
+  const cv::Mat expected = grey.makeSampleMatrix(crop, 10, 20);
+  EXPECT_EQ(0, cv::norm(expected, free.makeSampleMatrix(staffFree, 10, 20),
+                        cv::NORM_INF));
+  EXPECT_GT(cv::norm(expected, free.makeSampleMatrix(crop, 10, 20),
+                     cv::NORM_INF), 0);
+}
+
+TEST(ShapesTestSuite, TestPreClassify) {
+  using musicocr::TrainingKey;
+  musicocr::ShapeFinder finder((musicocr::ContourConfig()));
+
+  musicocr::Shape speck(cv::Rect(10, 10, 3, 2));
+  EXPECT_TRUE(finder.preClassify(&speck));
+  EXPECT_EQ(TrainingKey::TopLevelCategory::round,
+            speck.getTopLevelCategory());
+  EXPECT_EQ(TrainingKey::Category::speck, speck.getCategory());
+
+  musicocr::Shape connector(cv::Rect(10, 10, 30, 2));
+  EXPECT_TRUE(finder.preClassify(&connector));
+  EXPECT_EQ(TrainingKey::TopLevelCategory::hline,
+            connector.getTopLevelCategory());
+  EXPECT_EQ(TrainingKey::Category::connector, connector.getCategory());
+
+  // The aspect ratio isPotentialBarLine goes by: 14 / 4 = 3.5.
+  musicocr::Shape vertical(cv::Rect(10, 10, 4, 14));
+  EXPECT_TRUE(finder.preClassify(&vertical));
+  EXPECT_EQ(TrainingKey::TopLevelCategory::vline,
+            vertical.getTopLevelCategory());
+  EXPECT_EQ(TrainingKey::Category::vertical, vertical.getCategory());
+
+  // Just past each limit: left to the stat models, untouched.
+  for (const cv::Rect& r : {cv::Rect(10, 10, 4, 3),     // too big a speck
+                            cv::Rect(10, 10, 30, 3),    // too thick
+                            cv::Rect(10, 10, 15, 2),    // too short
+                            cv::Rect(10, 10, 5, 30),    // too wide
+                            cv::Rect(10, 10, 4, 13),    // too short
+                            cv::Rect(10, 10, 7, 6)}) {  // a note head
+    musicocr::Shape shape(r);
+    EXPECT_FALSE(finder.preClassify(&shape)) << r;
+    EXPECT_EQ(TrainingKey::Category::undefined, shape.getCategory()) << r;
+  }
+
+  musicocr::ContourConfig off;
+  off.maxSpeckSize = 0;
+  off.maxConnectorHeight = 0;
+  off.maxVerticalWidth = 0;
+  musicocr::ShapeFinder none(off);
+  musicocr::Shape shape(cv::Rect(10, 10, 3, 2));
+  EXPECT_FALSE(none.preClassify(&shape));
+}
+
+TEST(ShapesTestSuite, TestPreClassifyScalesWithStaff) {
+  // Staff lines twice as far apart as on the photos the sizes were tuned
+  // on, specks of 5 x 5 in the top space and a note head in the third.
+  cv::Mat page(200, 800, CV_8UC1, cv::Scalar(255));
+  for (int k = 0; k < 5; k++) {
+    cv::line(page, cv::Point(20, 60 + 12 * k), cv::Point(779, 60 + 12 * k),
+             cv::Scalar(0), 1);
+  }
+  for (int x = 100; x < 700; x += 150) {
+    page(cv::Rect(x, 64, 5, 5)).setTo(0);
+  }
+  cv::circle(page, cv::Point(720, 90), 5, cv::Scalar(0), -1);
+  musicocr::SheetConfig sheetConfig;
+  sheetConfig.gridEngine = musicocr::SheetConfig::PROJECTION;
+  musicocr::Sheet sheet(sheetConfig);
+  sheet.createSheetLines({cv::Rect(20, 55, 760, 58)}, page);
+  ASSERT_EQ(1, sheet.getLineCount());
+  ASSERT_TRUE(sheet.getNthLine(0).isRealMusicLine());
+  ASSERT_NEAR(2.0, sheet.getNthLine(0).getStaffMetrics().scale(), 0.1);
+
+  const int count =
+      musicocr::SampleData::featureCount(musicocr::SampleData::PIXELS);
+  cv::Mat samples(2, count, CV_32F, cv::Scalar(0));
+  samples.row(1).setTo(255);
+  cv::Ptr<cv::ml::KNearest> coarse = cv::ml::KNearest::create();
+  coarse->setDefaultK(1);
+  coarse->train(samples, cv::ml::ROW_SAMPLE,
+                cv::Mat((cv::Mat_<int>(2, 1)
+                         << musicocr::TrainingKey::TopLevelCategory::round,
+                         musicocr::TrainingKey::TopLevelCategory::composite)));
+  musicocr::ContourConfig config;
+  config.clusterShapes = false;
+  musicocr::ShapeFinder finder(config);
+  finder.initLineScan(sheet.getNthLine(0), coarse, nullptr);
+  // At 3 pixels the specks would have gone to the model; the note head
+  // still does.
+  const musicocr::ScanStatistics& statistics = finder.getStatistics();
+  EXPECT_LE(4, statistics.preClassified);
+  EXPECT_LE(1, statistics.coarseInferences);
+}
+
+TEST(ShapesTestSuite, TestShapeDescriptor) {
+  cv::Mat ring(9, 9, CV_8UC1, cv::Scalar(255));
+  cv::circle(ring, cv::Point(4, 4), 3, cv::Scalar(0), 1);
+  cv::Mat dot(9, 9, CV_8UC1, cv::Scalar(255));
+  cv::circle(dot, cv::Point(4, 4), 3, cv::Scalar(0), -1);
+  // The same ring, less contrasty.
+  cv::Mat faint;
+  ring.convertTo(faint, CV_8U, 0.6, 40);
+
+  const cv::Rect box(100, 20, 9, 9);
+  const musicocr::ShapeDescriptor first(box, ring);
+  EXPECT_LT(first.distance(musicocr::ShapeDescriptor(box, faint), 1, 4),
+            0.01f);
+  // Anywhere along the line, but not elsewhere on the staff.
+  EXPECT_LT(first.distance(
+      musicocr::ShapeDescriptor(box + cv::Point(300, 4), faint), 1, 4),
+      0.01f);
+  EXPECT_GT(first.distance(
+      musicocr::ShapeDescriptor(box + cv::Point(0, 5), ring), 1, 4), 1.0f);
+  EXPECT_GT(first.distance(
+      musicocr::ShapeDescriptor(box + cv::Size(2, 0), ring), 1, 4), 1.0f);
+  EXPECT_GT(first.distance(musicocr::ShapeDescriptor(box, dot), 1, 4),
+            musicocr::ContourConfig().clusterDistance);
+}
+
+TEST(ShapesTestSuite, TestClusterShapes) {
+  // One staff with a bar line at its start, and note heads drawn the
+  // same way in two of its spaces: four in the top space, two in the
+  // third.
+  cv::Mat page(200, 800, CV_8UC1, cv::Scalar(255));
+  for (int k = 0; k < 5; k++) {
+    cv::line(page, cv::Point(20, 60 + 8 * k), cv::Point(779, 60 + 8 * k),
+             cv::Scalar(0), 1);
+  }
+  page(cv::Rect(24, 60, 2, 33)).setTo(0);
+  for (int x = 100; x < 700; x += 150) {
+    cv::circle(page, cv::Point(x, 64), 3, cv::Scalar(60), -1);
+  }
+  for (int x = 175; x < 700; x += 300) {
+    cv::circle(page, cv::Point(x, 80), 3, cv::Scalar(60), -1);
+  }
+  musicocr::SheetConfig sheetConfig;
+  sheetConfig.gridEngine = musicocr::SheetConfig::PROJECTION;
+  musicocr::Sheet sheet(sheetConfig);
+  sheet.createSheetLines({cv::Rect(20, 55, 760, 42)}, page);
+  ASSERT_EQ(1, sheet.getLineCount());
+  ASSERT_TRUE(sheet.getNthLine(0).isRealMusicLine());
+
+  // Models that answer anything; only how often they are asked counts.
+  const int count =
+      musicocr::SampleData::featureCount(musicocr::SampleData::PIXELS);
+  cv::Mat samples(2, count, CV_32F, cv::Scalar(0));
+  samples.row(1).setTo(255);
+  auto train = [&samples](int first, int second) {
+    cv::Ptr<cv::ml::KNearest> knn = cv::ml::KNearest::create();
+    knn->setDefaultK(1);
+    knn->train(samples, cv::ml::ROW_SAMPLE,
+               cv::Mat((cv::Mat_<int>(2, 1) << first, second)));
+    return knn;
+  };
+  const cv::Ptr<cv::ml::StatModel> coarse =
+      train(musicocr::TrainingKey::TopLevelCategory::round,
+            musicocr::TrainingKey::TopLevelCategory::composite);
+  const cv::Ptr<cv::ml::StatModel> fine =
+      train(musicocr::TrainingKey::Category::notehead,
+            musicocr::TrainingKey::Category::dot);
+  auto scan = [&](const musicocr::ContourConfig& config) {
+    musicocr::ShapeFinder finder(config);
+    finder.initLineScan(sheet.getNthLine(0), coarse, fine);
+    return finder.getStatistics();
+  };
+
+  musicocr::ContourConfig off, anywhere;
+  off.clusterShapes = false;
+  anywhere.clusterPositionTolerance = 1000;
+  const musicocr::ScanStatistics each = scan(off);
+  const musicocr::ScanStatistics clustered = scan(musicocr::ContourConfig());
+  const musicocr::ScanStatistics loose = scan(anywhere);
+
+  EXPECT_EQ(0, each.clusters);
+  EXPECT_EQ(each.coarseInferences, clustered.clusteredShapes);
+  // Each cluster is classified once, for its first shape.
+  EXPECT_EQ(clustered.clusters, clustered.coarseInferences);
+  // One inference per space of note heads instead of six...
+  EXPECT_LE(clustered.coarseInferences, each.coarseInferences - 4);
+  // ... and one for both if the height on the staff didn't count.
+  EXPECT_EQ(clustered.clusters - 1, loose.clusters);
+}
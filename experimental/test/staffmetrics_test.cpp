@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include "staffmetrics.hpp"
+#include "opencv2/opencv.hpp"
+
+namespace {
+
+// Four staves of five lines, thickness rows thick and distance apart,
+// with a note head on each.
+cv::Mat staves(int thickness, int distance) {
+  cv::Mat page(24 * distance, 50 * distance, CV_8UC1, cv::Scalar(220));
+  for (int staff = 0; staff < 4; staff++) {
+    const int top = (2 + staff * 6) * distance;
+    for (int k = 0; k < 5; k++) {
+      page(cv::Rect(distance, top + k * distance, 48 * distance, thickness))
+          .setTo(40);
+    }
+    cv::circle(page, cv::Point(10 * distance * (staff + 1), top + distance),
+               distance / 2, cv::Scalar(40), -1);
+  }
+  return page;
+}
+
+}  // namespace
+
+TEST(StaffMetricsTestSuite, TestMeasuresStaves) {
+  const musicocr::StaffMetrics small = musicocr::estimateStaffMetrics(
+      staves(1, 6));
+  ASSERT_FALSE(small.empty());
+  EXPECT_NEAR(1.0, small.lineThickness, 0.2);
+  EXPECT_NEAR(5.0, small.staffSpace, 0.2);
+  // That's what the pixel sizes were tuned for.
+  EXPECT_NEAR(1.0, small.scale(), 0.05);
+  EXPECT_EQ(40, small.scaled(40));
+
+  const musicocr::StaffMetrics large = musicocr::estimateStaffMetrics(
+      staves(2, 12));
+  ASSERT_FALSE(large.empty());
+  EXPECT_NEAR(2.0, large.lineThickness, 0.2);
+  EXPECT_NEAR(10.0, large.staffSpace, 0.2);
+  EXPECT_NEAR(2.0, large.scale(), 0.05);
+  EXPECT_EQ(80, large.scaled(40));
+  EXPECT_NEAR(80000, large.scaledArea(20000), 4000);
+}
+
+TEST(StaffMetricsTestSuite, TestNoStaves) {
+  // Blobs and no lines: no staff space to speak of.
+  cv::Mat page(300, 400, CV_8UC1, cv::Scalar(220));
+  cv::RNG rng(5);
+  for (int i = 0; i < 80; i++) {
+    cv::circle(page, cv::Point(rng.uniform(0, 400), rng.uniform(0, 300)),
+               rng.uniform(2, 20), cv::Scalar(40), -1);
+  }
+  const musicocr::StaffMetrics metrics = musicocr::estimateStaffMetrics(page);
+  EXPECT_TRUE(metrics.empty());
+  // Sizes stay as they are.
+  EXPECT_DOUBLE_EQ(1.0, metrics.scale());
+  EXPECT_EQ(40, metrics.scaled(40));
+  EXPECT_EQ(20000, metrics.scaledArea(20000));
+  EXPECT_EQ(1, metrics.scaled(0));
+}
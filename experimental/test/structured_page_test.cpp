@@ -5,6 +5,7 @@
 #include "corners.hpp"
 #include "shapes.hpp"
 #include "structured_page.hpp"
+#include "training.hpp"
 #include "opencv2/opencv.hpp"
 
 void initLineCountMap(std::map<std::string, int>& m) {
@@ -47,6 +48,254 @@ TEST(StructuredPageTestSuite, TestLineFinding) {
   }
 }
 
+TEST(StructuredPageTestSuite, TestProjectionEngine) {
+  // A white page with one staff and a few note heads on it.
+  cv::Mat page(300, 800, CV_8UC1, cv::Scalar(255));
+  const std::vector<int> staff = {60, 68, 76, 84, 92};
+  for (int y : staff) {
+    cv::line(page, cv::Point(20, y), cv::Point(779, y), cv::Scalar(0), 1);
+  }
+  for (int x = 100; x < 700; x += 150) {
+    cv::circle(page, cv::Point(x, 72), 3, cv::Scalar(0), -1);
+  }
+
+  musicocr::SheetConfig config;
+  config.gridEngine = musicocr::SheetConfig::PROJECTION;
+  musicocr::Sheet sheet(config);
+  sheet.createSheetLines({cv::Rect(20, 55, 760, 42)}, page);
+  ASSERT_EQ(1, sheet.getLineCount());
+  musicocr::SheetLine& sl = sheet.getNthLine(0);
+  ASSERT_TRUE(sl.isRealMusicLine());
+  EXPECT_FLOAT_EQ(0.0, sl.getSlope());
+  const int top = sl.getBoundingBox().y;
+  EXPECT_EQ(staff.front(), sl.getCoordinates().first + top);
+  EXPECT_EQ(staff.back(), sl.getCoordinates().second + top);
+}
+
+TEST(StructuredPageTestSuite, TestShearModel) {
+  // A staff that bends down by 12px from left to right, as on a page
+  // that didn't lie flat.
+  cv::Mat page(300, 800, CV_8UC1, cv::Scalar(255));
+  auto offset = [](int x) {
+    const double u = (x - 20) / 760.0;
+    return 20.0 * u - 8.0 * u * u;
+  };
+  for (int k = 0; k < 5; k++) {
+    std::vector<cv::Point> points;
+    for (int x = 20; x < 780; x++) {
+      points.emplace_back(x, cvRound(60 + 8 * k + offset(x)));
+    }
+    cv::polylines(page, points, false, cv::Scalar(0), 1);
+  }
+  for (int x = 100; x < 700; x += 150) {
+    cv::circle(page, cv::Point(x, cvRound(72 + offset(x))), 3,
+               cv::Scalar(0), -1);
+  }
+
+  musicocr::SheetConfig config;
+  config.gridEngine = musicocr::SheetConfig::PROJECTION;
+  config.projectionStrips = 16;
+  config.deskew = musicocr::SheetConfig::SHEAR;
+  musicocr::Sheet sheet(config);
+  sheet.createSheetLines({cv::Rect(20, 40, 760, 80)}, page);
+  ASSERT_EQ(1, sheet.getLineCount());
+  musicocr::SheetLine& sl = sheet.getNthLine(0);
+  ASSERT_TRUE(sl.isRealMusicLine());
+  ASSERT_TRUE(sl.hasShear());
+  const cv::Point tl = sl.getBoundingBox().tl();
+  for (int x : {20, 100, 300, 500, 700, 779}) {
+    const std::pair<int, int> tb = sl.getCoordinatesAt(x - tl.x);
+    EXPECT_NEAR(60 + offset(x), tb.first + tl.y, 1.5) << "at " << x;
+    EXPECT_NEAR(92 + offset(x), tb.second + tl.y, 1.5) << "at " << x;
+  }
+}
+
+TEST(StructuredPageTestSuite, TestScaleToStaff) {
+  // A staff from closer up than the 0.2 photos: lines 12 pixels apart
+  // instead of about 6. Its outline is too large for the fixed limits.
+  cv::Mat page(200, 1300, CV_8UC1, cv::Scalar(255));
+  for (int k = 0; k < 5; k++) {
+    page(cv::Rect(40, 60 + 12 * k, 1200, 2)).setTo(0);
+  }
+  const std::vector<cv::Rect> outlines = {cv::Rect(40, 45, 1200, 80)};
+  musicocr::Sheet sheet;
+  sheet.createSheetLines(outlines, page);
+  EXPECT_TRUE(sheet.getStaffMetrics().empty());
+  EXPECT_EQ(0, sheet.getLineCount());
+
+  musicocr::SheetConfig config;
+  config.scaleToStaff = true;
+  musicocr::Sheet scaled(config);
+  scaled.createSheetLines(outlines, page);
+  EXPECT_NEAR(12.0, scaled.getStaffMetrics().lineDistance(), 0.5);
+  ASSERT_EQ(1, scaled.getLineCount());
+  // The paddings grow with the staves: 40 rows and 20 columns.
+  EXPECT_EQ(cv::Rect(20, 5, 1240, 160),
+            scaled.getNthLine(0).getBoundingBox());
+}
+
+TEST(StructuredPageTestSuite, TestPeriodicityCheck) {
+  // One staff, a few lines of text and an empty area, each with an
+  // outline that passes the size limits.
+  cv::Mat page(400, 800, CV_8UC1, cv::Scalar(255));
+  for (int k = 0; k < 5; k++) {
+    cv::line(page, cv::Point(20, 60 + 8 * k), cv::Point(779, 60 + 8 * k),
+             cv::Scalar(0), 1);
+  }
+  for (int x = 100; x < 700; x += 150) {
+    cv::circle(page, cv::Point(x, 72), 3, cv::Scalar(0), -1);
+  }
+  for (int y = 165; y < 200; y += 13) {
+    cv::putText(page, "Allegro ma non troppo, con espressione e dolce",
+                cv::Point(30, y), cv::FONT_HERSHEY_SIMPLEX, 0.4,
+                cv::Scalar(50), 1);
+  }
+  const std::vector<cv::Rect> outlines = {cv::Rect(20, 55, 760, 42),
+                                          cv::Rect(20, 150, 760, 50),
+                                          cv::Rect(20, 260, 760, 50)};
+
+  musicocr::SheetConfig config;
+  config.gridEngine = musicocr::SheetConfig::PROJECTION;
+  config.periodicityCheck = true;
+  musicocr::Sheet sheet(config);
+  sheet.createSheetLines(outlines, page);
+  // Rejected lines are still there, they just aren't music.
+  ASSERT_EQ(3, sheet.getLineCount());
+  EXPECT_TRUE(sheet.getNthLine(0).isRealMusicLine());
+  EXPECT_FALSE(sheet.getNthLine(1).isRealMusicLine());
+  EXPECT_FALSE(sheet.getNthLine(2).isRealMusicLine());
+  // And the sheet line knows why, for printSheetInfo.
+  EXPECT_TRUE(sheet.getNthLine(0).hasRepeatingRows());
+  EXPECT_FALSE(sheet.getNthLine(1).hasRepeatingRows());
+  EXPECT_FALSE(sheet.getNthLine(2).hasRepeatingRows());
+  const int top = sheet.getNthLine(0).getBoundingBox().y;
+  EXPECT_EQ(60, sheet.getNthLine(0).getCoordinates().first + top);
+  EXPECT_EQ(92, sheet.getNthLine(0).getCoordinates().second + top);
+}
+
+TEST(StructuredPageTestSuite, TestPageShapes) {
+  // Two staves whose viewports overlap between rows 105 and 117, with a
+  // few note heads on each and three blobs in the overlap: closer to the
+  // top staff, about as close to both, and closer to the bottom staff.
+  cv::Mat page(300, 800, CV_8UC1, cv::Scalar(255));
+  for (int top : {60, 130}) {
+    for (int k = 0; k < 5; k++) {
+      cv::line(page, cv::Point(20, top + 8 * k), cv::Point(779, top + 8 * k),
+               cv::Scalar(0), 1);
+    }
+  }
+  for (int x = 100; x < 700; x += 150) {
+    cv::circle(page, cv::Point(x, 72), 3, cv::Scalar(60), -1);
+    cv::circle(page, cv::Point(x, 142), 3, cv::Scalar(60), -1);
+  }
+  for (int x : {300, 400, 500}) {
+    page(cv::Rect(x, 105 + (x - 300) / 20, 6, 4)).setTo(60);
+  }
+
+  musicocr::SheetConfig config;
+  config.gridEngine = musicocr::SheetConfig::PROJECTION;
+  musicocr::Sheet sheet(config);
+  sheet.createSheetLines({cv::Rect(20, 55, 760, 42),
+                          cv::Rect(20, 125, 760, 42)}, page);
+  ASSERT_EQ(2, sheet.getLineCount());
+  ASSERT_TRUE(sheet.getNthLine(0).isRealMusicLine());
+  ASSERT_TRUE(sheet.getNthLine(1).isRealMusicLine());
+
+  const musicocr::ContourConfig contourConfig;
+  musicocr::PageShapes pageShapes(contourConfig);
+  pageShapes.segment(sheet);
+  EXPECT_EQ(11, pageShapes.size());
+  EXPECT_EQ(1, pageShapes.getSharedCount());
+  ASSERT_TRUE(pageShapes.covers(0));
+  ASSERT_TRUE(pageShapes.covers(1));
+  EXPECT_EQ(6, pageShapes.getLineShapes(0).size());
+  EXPECT_EQ(6, pageShapes.getLineShapes(1).size());
+
+  // On its own, the top line also gets the blob of the bottom staff.
+  const musicocr::SheetLine& top = sheet.getNthLine(0);
+  musicocr::ShapeFinder lineFinder(contourConfig);
+  EXPECT_EQ(7, lineFinder.getContourBoxes(top).size());
+  musicocr::ShapeFinder pageFinder(contourConfig);
+  pageFinder.setPageShapes(&pageShapes, 0);
+  const std::vector<cv::Rect>& boxes = pageFinder.getContourBoxes(top);
+  ASSERT_EQ(6, boxes.size());
+  const cv::Point tl = top.getBoundingBox().tl();
+  EXPECT_NE(boxes.end(), std::find(boxes.begin(), boxes.end(),
+                                   cv::Rect(299, 104, 8, 6) - tl));
+  EXPECT_NE(boxes.end(), std::find(boxes.begin(), boxes.end(),
+                                   cv::Rect(399, 109, 8, 6) - tl));
+  // The third blob is nearer the bottom staff; in the blob band nothing
+  // right of the second blob is left on this line.
+  const cv::Rect third = cv::Rect(499, 114, 8, 6) & top.getBoundingBox();
+  EXPECT_EQ(boxes.end(), std::find(boxes.begin(), boxes.end(), third - tl));
+  for (const auto& r : boxes) {
+    if (r.y + tl.y < 100) continue;
+    EXPECT_LT(r.x + tl.x, 450) << r;
+  }
+
+  // The second blob is in both lines, but at a different height in
+  // each viewport, and the samples hold that height: each line
+  // classifies it on its own.
+  const musicocr::SheetLine& bottom = sheet.getNthLine(1);
+  const cv::Rect blob(399, 109, 8, 6);
+  EXPECT_NE(blob.y - top.getBoundingBox().y,
+            blob.y - bottom.getBoundingBox().y);
+  const int count =
+      musicocr::SampleData::featureCount(musicocr::SampleData::PIXELS);
+  cv::Mat samples(2, count, CV_32F, cv::Scalar(0));
+  samples.row(1).setTo(255);
+  cv::Ptr<cv::ml::KNearest> coarse = cv::ml::KNearest::create();
+  coarse->setDefaultK(1);
+  coarse->train(samples, cv::ml::ROW_SAMPLE,
+                cv::Mat((cv::Mat_<int>(2, 1)
+                         << musicocr::TrainingKey::TopLevelCategory::round,
+                         musicocr::TrainingKey::TopLevelCategory::composite)));
+  musicocr::ContourConfig unclustered = contourConfig;
+  unclustered.clusterShapes = false;
+  int classified = 0;
+  for (size_t line = 0; line < 2; line++) {
+    musicocr::ShapeFinder finder(unclustered);
+    finder.setPageShapes(&pageShapes, line);
+    finder.initLineScan(sheet.getNthLine(line), coarse, nullptr);
+    const musicocr::ScanStatistics& statistics = finder.getStatistics();
+    EXPECT_EQ(6, statistics.shapes);
+    classified += statistics.preClassified + statistics.coarseInferences;
+  }
+  EXPECT_EQ(12, classified);
+}
+
+TEST(StructuredPageTestSuite, TestPageShapesThresholdPerLine) {
+  // A dark staff and a faint one. With one threshold for the whole page
+  // the faint staff's note heads would be lost.
+  cv::Mat page(300, 800, CV_8UC1, cv::Scalar(255));
+  for (int top : {60, 170}) {
+    const cv::Scalar ink(top == 60 ? 60 : 200);
+    for (int k = 0; k < 5; k++) {
+      cv::line(page, cv::Point(20, top + 8 * k), cv::Point(779, top + 8 * k),
+               ink, 1);
+    }
+    for (int x = 100; x < 700; x += 150) {
+      cv::circle(page, cv::Point(x, top + 12), 3, ink, -1);
+    }
+  }
+
+  musicocr::SheetConfig config;
+  config.gridEngine = musicocr::SheetConfig::PROJECTION;
+  musicocr::Sheet sheet(config);
+  sheet.createSheetLines({cv::Rect(20, 55, 760, 42),
+                          cv::Rect(20, 165, 760, 42)}, page);
+  ASSERT_EQ(2, sheet.getLineCount());
+
+  musicocr::ShapeFinder finder((musicocr::ContourConfig()));
+  int dark = 0, faint = 0;
+  for (const auto& r : finder.getContourBoxes(sheet)) {
+    if (r.width < 9) continue;
+    (r.y < 120 ? dark : faint)++;
+  }
+  EXPECT_EQ(4, dark);
+  EXPECT_EQ(4, faint);
+}
+
 #if 0
 void initVoiceMap(std::map<std::string, std::vector<int>>& m) {
   m.emplace("sample1.jpg",
@@ -23,15 +23,21 @@ int main(int argc, char** argv) {
     modelfile = "model." + datasetname;
   }
 
+  cv::Ptr<cv::ml::KNearest> knn =
+     cv::ml::StatModel::load<cv::ml::KNearest>(
+       musicocr::SampleDataFiles::modelFileName(modelfile, "knn"));
   musicocr::SampleData collector;
+  // The models were trained together, so they all take the same
+  // features as the knn model.
+  collector.setFeatureType(musicocr::SampleData::featureTypeOf(*knn));
+  std::cout << "features: "
+            << (collector.getFeatureType() == musicocr::SampleData::BITS
+                ? "bits" : "pixels") << std::endl;
   musicocr::SampleDataFiles files;
   files.readFiles(directory, fnamePattern, musicocr::TrainingKey::statmodel);
   files.initCollector(directory, collector);
 
   {
-  cv::Ptr<cv::ml::KNearest> knn =
-     cv::ml::StatModel::load<cv::ml::KNearest>(
-       musicocr::SampleDataFiles::modelFileName(modelfile, "knn"));
   cv::Mat predictions, neighbours, dist;
   std::ofstream out;
   out.open(musicocr::SampleDataFiles::makeModelOutputName(
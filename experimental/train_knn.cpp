@@ -11,7 +11,7 @@ using std::string;
 int main(int argc, char** argv) {
   if (argc < 2) {
     cerr << "TrainKnn <training data directory> [modelfile basename] "
-         << " [file name pattern]" << endl;
+         << " [file name pattern] [pixels|bits] [grey|staff-free]" << endl;
     return -1;
   }
   const string directory = argv[1];
@@ -39,6 +39,16 @@ int main(int argc, char** argv) {
 
   musicocr::SampleData collector, collector_fine;
   collector_fine.setPreprocessing(true);
+  // Bit features (see SampleData::FeatureType) instead of pixels.
+  if (argc > 4 && string(argv[4]) == "bits") {
+    collector.setFeatureType(musicocr::SampleData::BITS);
+    collector_fine.setFeatureType(musicocr::SampleData::BITS);
+  }
+  // Crops saved from the staff-free page (ContourConfig::
+  // staffFreeSamples) don't need their horizontal lines removed again.
+  if (argc > 5 && string(argv[5]) == "staff-free") {
+    collector_fine.setStaffFree(true);
+  }
   musicocr::SampleDataFiles files, files_fine;
   files.readFiles(directory, filenamepattern, musicocr::TrainingKey::statmodel);
   files_fine.readFiles(directory, filenamepattern, musicocr::TrainingKey::basic);